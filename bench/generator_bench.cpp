@@ -0,0 +1,155 @@
+/* -*- C++ -*-
+ *
+ * Benchmark of pulling output through chunk_generator (generator.h)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * The same lines (of a typical size) are consumed in two ways: pushed
+ * by the producer into a stream whose buffer hands each full buffer to
+ * the consumer directly (the push model of print_commands), or pulled
+ * by the consumer from a chunk_generator that runs the producer in a
+ * thread of its own. The consumer checksums every byte, and both ways
+ * must yield the same checksum. This is repeated for several buffer
+ * sizes.
+ *
+ * Usage: generator_bench [MEGABYTES]
+ */
+
+#include "../generator.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <streambuf>
+#include <string>
+
+struct consumer {
+    consumer() : bytes(0), sum(0) {}
+
+    void take(const char *data, size_t len) {
+        for (size_t i = 0; i < len; ++i) {
+            sum = sum * 31 + (unsigned char)data[i];
+        }
+        bytes += len;
+    }
+
+    uint64_t bytes;
+    uint64_t sum;
+};
+
+// hands each full buffer to the consumer (in the producer's thread)
+class push_buf : public std::streambuf {
+public:
+    push_buf(consumer *c, size_t size) : c(c), buf(size, '\0') {
+        setp(&buf[0], &buf[0] + size);
+    }
+
+protected:
+    int_type overflow(int_type ch) {
+        sync();
+        if (ch != traits_type::eof()) {
+            *pptr() = traits_type::to_char_type(ch);
+            pbump(1);
+        }
+        return traits_type::not_eof(ch);
+    }
+
+    int sync() {
+        c->take(pbase(), pptr() - pbase());
+        setp(&buf[0], &buf[0] + buf.size());
+        return 0;
+    }
+
+private:
+    consumer *c;
+    std::string buf;
+};
+
+static void write_lines(std::ostream &out, uint64_t bytes)
+{
+    const std::string line =
+        "(assert (! (or (not x12) (bvult x3 (bvadd x7 #x0000002a))) "
+        ":named smtcomp42))\n";
+    for (uint64_t n = 0; n < bytes; n += line.size()) {
+        out << line;
+    }
+    out.flush();
+}
+
+static double seconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t megabytes = argc > 1 ? strtoull(argv[1], NULL, 10) : 256;
+    if (megabytes == 0) {
+        fprintf(stderr, "MEGABYTES must be positive\n");
+        return 1;
+    }
+    uint64_t bytes = megabytes << 20;
+
+    printf("%10s %12s %12s %10s\n", "buffer", "push MB/s", "pull MB/s",
+           "chunks");
+    for (size_t size = 1 << 12; size <= 1 << 22; size <<= 2) {
+        consumer pushed;
+        std::chrono::steady_clock::time_point start =
+            std::chrono::steady_clock::now();
+        {
+            push_buf buf(&pushed, size);
+            std::ostream out(&buf);
+            write_lines(out, bytes);
+        }
+        double push_secs = seconds_since(start);
+
+        consumer pulled;
+        uint64_t chunks = 0;
+        start = std::chrono::steady_clock::now();
+        {
+            scrambler::chunk_generator gen([bytes](std::ostream &out) {
+                write_lines(out, bytes);
+            }, size);
+            std::string chunk;
+            while (gen.next(chunk)) {
+                if (chunk.size() > size) {
+                    fprintf(stderr, "ERROR chunk exceeds the buffer size\n");
+                    return 1;
+                }
+                pulled.take(chunk.data(), chunk.size());
+                ++chunks;
+            }
+        }
+        double pull_secs = seconds_since(start);
+
+        if (pushed.bytes != pulled.bytes || pushed.sum != pulled.sum) {
+            fprintf(stderr, "ERROR pulled output differs with buffer size %zu\n",
+                    size);
+            return 1;
+        }
+        double mb = pushed.bytes / 1e6;
+        printf("%10zu %12.1f %12.1f %10llu\n", size, mb / push_secs,
+               mb / pull_secs, (unsigned long long)chunks);
+    }
+
+    return 0;
+}
@@ -0,0 +1,159 @@
+/* -*- C++ -*-
+ *
+ * Contention benchmark for the concurrent intern table (intern.h)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Every thread interns the same set of names (in a thread-specific
+ * order, so that threads race for the same slots), then looks each of
+ * them up. This is repeated for 1, 2, 4, ..., 64 threads, once with a
+ * table that is reserved for all names and once with a table that grows
+ * while the threads insert. After each round, the name ids handed out by
+ * assign_ids are checked against the declaration order, which must not
+ * depend on the number of threads. (test/run_tests.sh runs it as a test.)
+ *
+ * Usage: intern_bench [NUM_NAMES]
+ */
+
+#include "../intern.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+using scrambler::intern_table;
+
+static void intern_all(intern_table *table,
+                       const std::vector<std::string> *names, size_t self)
+{
+    size_t n = names->size();
+    // a thread-specific stride through the names
+    size_t stride = 2 * self + 1;
+    while (n % stride == 0 && stride > 1) {
+        stride += 2;
+    }
+    for (size_t k = 0, i = self % n; k < n; ++k, i = (i + stride) % n) {
+        const std::string &name = (*names)[i];
+        table->insert(name.data(), name.size(), i);
+    }
+}
+
+static void lookup_all(const intern_table *table,
+                       const std::vector<std::string> *names, size_t self,
+                       size_t *misses)
+{
+    size_t n = names->size();
+    *misses = 0;
+    for (size_t k = 0, i = self % n; k < n; ++k, i = (i + 1) % n) {
+        const std::string &name = (*names)[i];
+        if (!table->find(name.data(), name.size())) {
+            ++*misses;
+        }
+    }
+}
+
+// one round with the given number of threads; false if the name ids
+// are wrong
+static bool intern_round(const std::vector<std::string> &names,
+                         size_t threads, bool reserved, double *insert_secs,
+                         double *lookup_secs)
+{
+    size_t num_names = names.size();
+    intern_table table(reserved ? 0 : 16);
+    if (reserved) {
+        table.reserve(num_names);
+    }
+
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < threads; ++t) {
+        workers.push_back(std::thread(intern_all, &table, &names, t));
+    }
+    for (size_t t = 0; t < threads; ++t) {
+        workers[t].join();
+    }
+    *insert_secs = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+
+    std::vector<size_t> misses(threads);
+    workers.clear();
+    start = std::chrono::steady_clock::now();
+    for (size_t t = 0; t < threads; ++t) {
+        workers.push_back(
+            std::thread(lookup_all, &table, &names, t, &misses[t]));
+    }
+    for (size_t t = 0; t < threads; ++t) {
+        workers[t].join();
+    }
+    *lookup_secs = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+
+    uint64_t next_id = 1;
+    table.assign_ids(next_id);
+    bool ok = table.size() == num_names && next_id == num_names + 1;
+    for (size_t i = 0; ok && i < num_names; ++i) {
+        const intern_table::entry *e =
+            table.find(names[i].data(), names[i].size());
+        ok = e && e->id.load() == i + 1;
+    }
+    for (size_t t = 0; ok && t < threads; ++t) {
+        ok = misses[t] == 0;
+    }
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    size_t num_names = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+    if (num_names == 0) {
+        fprintf(stderr, "NUM_NAMES must be positive\n");
+        return 1;
+    }
+
+    std::vector<std::string> names(num_names);
+    for (size_t i = 0; i < num_names; ++i) {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "name_%zu", i);
+        names[i] = buf;
+    }
+
+    printf("%8s %14s %14s %14s\n", "threads", "insert Mops/s",
+           "growing Mops/s", "lookup Mops/s");
+    for (size_t threads = 1; threads <= 64; threads *= 2) {
+        double insert_secs, grow_secs, lookup_secs, unused;
+        if (!intern_round(names, threads, true, &insert_secs,
+                          &lookup_secs) ||
+            !intern_round(names, threads, false, &grow_secs, &unused)) {
+            fprintf(stderr, "ERROR name ids differ with %zu threads\n",
+                    threads);
+            return 1;
+        }
+
+        double ops = (double)threads * num_names / 1e6;
+        printf("%8zu %14.2f %14.2f %14.2f\n", threads, ops / insert_secs,
+               ops / grow_secs, ops / lookup_secs);
+    }
+
+    return 0;
+}
@@ -0,0 +1,123 @@
+/* -*- C++ -*-
+ *
+ * Pipe throughput of output() (output.h) against std::cout
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+/*
+ * A child process writes the same lines (of a typical size) into a
+ * pipe, through std::cout or through output(), which hands its buffers
+ * to the pipe with vmsplice; the parent reads and discards them. The
+ * throughput includes the time that the parent takes to read.
+ *
+ * Usage: pipe_bench [MEGABYTES]
+ */
+
+#include "../output.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+static void write_lines(std::ostream &out, uint64_t bytes)
+{
+    const std::string line =
+        "(assert (! (or (not x12) (bvult x3 (bvadd x7 #x0000002a))) "
+        ":named smtcomp42))\n";
+    for (uint64_t n = 0; n < bytes; n += line.size()) {
+        out << line;
+    }
+    out.flush();
+}
+
+// returns the number of bytes received, and the time taken in secs
+static uint64_t run(bool use_output, uint64_t bytes, double *secs)
+{
+    int fds[2];
+    if (pipe(fds) != 0) {
+        perror("pipe");
+        exit(1);
+    }
+    // the child must not inherit buffered output
+    fflush(stdout);
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        exit(1);
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[1]);
+        // output() inspects stdout when it is first used
+        write_lines(use_output ? scrambler::output() : std::cout, bytes);
+        _exit(0);
+    }
+
+    close(fds[1]);
+    std::vector<char> buf(1 << 20);
+    uint64_t received = 0;
+    ssize_t n;
+    while ((n = read(fds[0], buf.data(), buf.size())) > 0) {
+        received += n;
+    }
+    close(fds[0]);
+    int status;
+    waitpid(pid, &status, 0);
+    *secs = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+    return received;
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t megabytes = argc > 1 ? strtoul(argv[1], NULL, 10) : 1024;
+    if (megabytes == 0) {
+        fprintf(stderr, "MEGABYTES must be positive\n");
+        return 1;
+    }
+    uint64_t bytes = megabytes << 20;
+
+    printf("%-10s %10s\n", "stream", "MB/s");
+    uint64_t expected = 0;
+    for (int i = 0; i < 2; ++i) {
+        double secs;
+        uint64_t received = run(i == 1, bytes, &secs);
+        if (i == 0) {
+            expected = received;
+        } else if (received != expected) {
+            fprintf(stderr, "ERROR received %llu bytes, expected %llu\n",
+                    (unsigned long long)received,
+                    (unsigned long long)expected);
+            return 1;
+        }
+        printf("%-10s %10.1f\n", i ? "output()" : "std::cout",
+               received / secs / (1 << 20));
+    }
+
+    return 0;
+}
@@ -0,0 +1,137 @@
+/* -*- C++ -*-
+ *
+ * Scaling benchmark for MergeShuffle (shuffle.h)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * For array sizes 10^4, 10^5, ..., up to MAX_ELEMENTS, an array of
+ * 32-bit integers is shuffled by Fisher-Yates (serially) and by
+ * MergeShuffle with 1, 2, 4, ... threads (up to the number of hardware
+ * threads). MergeShuffle's result must not depend on the number of
+ * threads.
+ *
+ * Before that, uniformity is checked: all permutations of a small
+ * array, shuffled with a block size that makes merges of unequal runs
+ * necessary, must be (about) equally frequent.
+ *
+ * Usage: shuffle_bench [MAX_ELEMENTS]   (default: 10^8; 10^9 needs 4 GB)
+ */
+
+#include "../shuffle.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <thread>
+#include <vector>
+
+using scrambler::merge_shuffle;
+
+static double seconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+// Shuffles 0..n-1 (n = 5, in blocks of 2) many times; returns whether
+// every permutation occurred within 5% of its expected frequency.
+static bool check_uniform()
+{
+    const size_t n = 5;
+    const size_t trials = 1200000;
+    std::map<std::vector<uint32_t>, size_t> counts;
+    std::vector<uint32_t> a(n);
+    for (size_t t = 0; t < trials; ++t) {
+        for (size_t i = 0; i < n; ++i) {
+            a[i] = i;
+        }
+        merge_shuffle(a.data(), n, t, 2);
+        ++counts[a];
+    }
+    double expected = trials / 120.0;
+    bool ok = counts.size() == 120;
+    for (std::map<std::vector<uint32_t>, size_t>::const_iterator it =
+             counts.begin(); it != counts.end(); ++it) {
+        if (it->second < expected * 0.95 || it->second > expected * 1.05) {
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t max_elements = argc > 1 ? strtoull(argv[1], NULL, 10) : 100000000;
+    if (max_elements < 10000) {
+        fprintf(stderr, "MAX_ELEMENTS must be at least 10000\n");
+        return 1;
+    }
+
+    if (!check_uniform()) {
+        fprintf(stderr, "ERROR permutations are not uniform\n");
+        return 1;
+    }
+
+    size_t max_threads = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+    printf("%12s %14s", "elements", "fisher-yates");
+    for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+        printf(" %9s%-3zu", "merge x", threads);
+    }
+    printf("   (M elements/s)\n");
+
+    for (uint64_t n = 10000; n <= max_elements; n *= 10) {
+        std::vector<uint32_t> a(n);
+        for (uint64_t i = 0; i < n; ++i) {
+            a[i] = i;
+        }
+        const uint64_t seed = 42;
+
+        scrambler::shuffle_rng rng(seed);
+        std::chrono::steady_clock::time_point start =
+            std::chrono::steady_clock::now();
+        scrambler::fisher_yates(a.data(), n, rng);
+        printf("%12llu %14.1f", (unsigned long long)n,
+               n / 1e6 / seconds_since(start));
+
+        std::vector<uint32_t> first;
+        for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+            scrambler::set_num_threads(threads);
+            for (uint64_t i = 0; i < n; ++i) {
+                a[i] = i;
+            }
+            start = std::chrono::steady_clock::now();
+            merge_shuffle(a.data(), n, seed);
+            printf(" %12.1f", n / 1e6 / seconds_since(start));
+            fflush(stdout);
+            if (first.empty()) {
+                first = a;
+            } else if (a != first) {
+                fprintf(stderr, "\nERROR permutation differs with %zu threads\n",
+                        threads);
+                return 1;
+            }
+        }
+        printf("\n");
+    }
+
+    return 0;
+}
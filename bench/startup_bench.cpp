@@ -0,0 +1,121 @@
+/* -*- C++ -*-
+ *
+ * Startup cost of the scrambler, which StarExec runs once per benchmark
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+/*
+ * Runs the scrambler RUNS times on a benchmark that only contains
+ * (check-sat), as StarExec's process scripts run it on each (mostly
+ * small) benchmark, and prints the minimum, median and 90th percentile
+ * of the wall-clock time from fork to exit. The time is dominated by
+ * starting the process (loading, dynamic linking, static initializers),
+ * which `make STATIC=` (a dynamically linked scrambler) shows.
+ *
+ * Usage: startup_bench [RUNS [SCRAMBLER [OPTION...]]]
+ *        (default: 1000 runs of ./scrambler, without options)
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+// returns the time in secs of one run of argv, or a negative number if
+// the scrambler failed
+static double run(char **argv, const char *input)
+{
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        exit(1);
+    }
+    if (pid == 0) {
+        int in = open(input, O_RDONLY);
+        int out = open("/dev/null", O_WRONLY);
+        if (in < 0 || out < 0) {
+            _exit(127);
+        }
+        dup2(in, STDIN_FILENO);
+        dup2(out, STDOUT_FILENO);
+        close(in);
+        close(out);
+        execv(argv[0], argv);
+        _exit(127);
+    }
+    int status;
+    if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+        WEXITSTATUS(status) != 0) {
+        return -1;
+    }
+    return std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char **argv)
+{
+    long runs = argc > 1 ? strtol(argv[1], NULL, 10) : 1000;
+    if (runs <= 0) {
+        fprintf(stderr, "RUNS must be positive\n");
+        return 1;
+    }
+    std::vector<char *> command;
+    command.push_back(argc > 2 ? argv[2] : (char *)"./scrambler");
+    for (int i = 3; i < argc; ++i) {
+        command.push_back(argv[i]);
+    }
+    command.push_back(NULL);
+
+    char input[] = "/tmp/startup_bench.XXXXXX";
+    int fd = mkstemp(input);
+    if (fd < 0 || write(fd, "(check-sat)\n", 12) != 12) {
+        perror("mkstemp");
+        return 1;
+    }
+    close(fd);
+
+    // the first runs fill the page cache
+    std::vector<double> secs;
+    for (long i = -10; i < runs; ++i) {
+        double t = run(command.data(), input);
+        if (t < 0) {
+            fprintf(stderr, "ERROR running %s\n", command[0]);
+            unlink(input);
+            return 1;
+        }
+        if (i >= 0) {
+            secs.push_back(t);
+        }
+    }
+    unlink(input);
+
+    std::sort(secs.begin(), secs.end());
+    printf("%-10s %10s %10s %10s\n", "runs", "min ms", "median ms", "p90 ms");
+    printf("%-10ld %10.3f %10.3f %10.3f\n", runs, secs[0] * 1e3,
+           secs[secs.size() / 2] * 1e3, secs[secs.size() * 9 / 10] * 1e3);
+    return 0;
+}
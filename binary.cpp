@@ -0,0 +1,305 @@
+/* -*- C++ -*-
+ *
+ * Binary term output format (-format binary)
+ *
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "binary.h"
+#include <assert.h>
+#include <string.h>
+
+namespace scrambler {
+
+namespace {
+
+void put_word(std::string &buf, uint32_t x)
+{
+    char bytes[4] = { (char)(x & 0xff), (char)((x >> 8) & 0xff),
+                      (char)((x >> 16) & 0xff), (char)(x >> 24) };
+    buf.append(bytes, 4);
+}
+
+void put_number(std::string &buf, uint32_t x)
+{
+    while (x >= 0x80) {
+        buf.push_back((char)(x | 0x80));
+        x >>= 7;
+    }
+    buf.push_back((char)x);
+}
+
+// reads a number at p (before end); returns false if it is truncated
+bool get_number(const char *&p, const char *end, uint32_t &x)
+{
+    x = 0;
+    for (unsigned shift = 0; p < end && shift < 35; shift += 7) {
+        unsigned char b = *p++;
+        x |= (uint32_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+uint32_t get_word(const char *p)
+{
+    const unsigned char *q = (const unsigned char *)p;
+    return q[0] | (q[1] << 8) | (q[2] << 16) | ((uint32_t)q[3] << 24);
+}
+
+// a decoded atom or list
+struct item {
+    int64_t symbol;  // -1 for lists
+    uint32_t first;
+    uint32_t count;
+};
+
+typedef std::vector<std::pair<const char *, uint32_t> > symbol_table;
+
+void print_item(const std::vector<item> &items,
+                const std::vector<uint32_t> &kids,
+                const symbol_table &symbols, uint32_t root, std::ostream &out)
+{
+    // explicit stack of (item, next child): deep terms must not overflow
+    // the C++ stack
+    std::vector<std::pair<uint32_t, uint32_t> > to_print;
+    to_print.push_back(std::make_pair(root, 0));
+    while (!to_print.empty()) {
+        std::pair<uint32_t, uint32_t> &top = to_print.back();
+        const item &it = items[top.first];
+        if (it.symbol >= 0) {
+            out.write(symbols[it.symbol].first, symbols[it.symbol].second);
+            to_print.pop_back();
+        } else if (top.second < it.count) {
+            out << (top.second == 0 ? '(' : ' ');
+            uint32_t child = kids[it.first + top.second++];
+            to_print.push_back(std::make_pair(child, 0));
+        } else {
+            out << (it.count == 0 ? "()" : ")");
+            to_print.pop_back();
+        }
+    }
+}
+
+} // namespace
+
+binary_encoder::binary_encoder() : counts(1, 0)
+{
+}
+
+binary_encoder &binary_encoder::operator<<(uint64_t x)
+{
+    char tmp[20];
+    size_t len = 0;
+    do {
+        tmp[len++] = '0' + (x % 10);
+        x /= 10;
+    } while (x);
+    while (len) {
+        atom.push_back(tmp[--len]);
+    }
+    return *this;
+}
+
+void binary_encoder::put(char c)
+{
+    switch (c) {
+    case '(':
+        end_atom();
+        counts.push_back(0);
+        break;
+    case ')':
+        end_atom();
+        assert(counts.size() > 1);
+        words.push_back((counts.back() << 1) | 1);
+        counts.pop_back();
+        ++counts.back();
+        break;
+    case ' ':
+    case '\n':
+        end_atom();
+        break;
+    default:
+        atom.push_back(c);
+    }
+}
+
+void binary_encoder::end_atom()
+{
+    if (atom.empty()) {
+        return;
+    }
+    std::pair<std::unordered_map<std::string, uint32_t>::iterator, bool> r =
+        symbols.insert(std::make_pair(atom, (uint32_t)symbols.size()));
+    if (r.second) {
+        new_symbols.push_back(&r.first->first);
+    }
+    words.push_back(r.first->second << 1);
+    ++counts.back();
+    atom.clear();
+}
+
+void binary_encoder::write(std::ostream &out)
+{
+    end_atom();
+    assert(counts.size() == 1);
+    std::string buf;
+    if (!new_symbols.empty()) {
+        std::string payload;
+        put_word(payload, new_symbols.size());
+        for (size_t i = 0; i < new_symbols.size(); ++i) {
+            const std::string &s = *new_symbols[i];
+            put_word(payload, s.size());
+            payload.append(s);
+            payload.append((4 - s.size() % 4) % 4, '\0');
+        }
+        put_word(buf, binary_symbols);
+        put_word(buf, payload.size());
+        buf.append(payload);
+        new_symbols.clear();
+    }
+    if (!words.empty()) {
+        std::string payload;
+        for (size_t i = 0; i < words.size(); ++i) {
+            put_number(payload, words[i]);
+        }
+        put_word(buf, binary_commands);
+        put_word(buf, payload.size());
+        buf.append(payload);
+        buf.append((4 - payload.size() % 4) % 4, '\0');
+        words.clear();
+    }
+    counts.assign(1, 0);
+    out.write(buf.data(), buf.size());
+}
+
+void write_binary_header(std::ostream &out)
+{
+    std::string buf(binary_magic, 4);
+    put_word(buf, binary_version);
+    out.write(buf.data(), buf.size());
+}
+
+bool decode_binary(const char *data, size_t len, std::ostream &out,
+                   std::string &error)
+{
+    if (len < 8 || memcmp(data, binary_magic, 4) != 0) {
+        error = "not a binary benchmark";
+        return false;
+    }
+    if (get_word(data + 4) != binary_version) {
+        error = "unsupported version";
+        return false;
+    }
+
+    // symbols refer to data, which is not copied
+    symbol_table symbols;
+    std::vector<item> items;
+    std::vector<uint32_t> kids;
+    std::vector<uint32_t> stack;
+    for (size_t pos = 8; pos < len; ) {
+        if (len - pos < 8) {
+            error = "truncated record";
+            return false;
+        }
+        uint32_t kind = get_word(data + pos);
+        uint32_t length = get_word(data + pos + 4);
+        pos += 8;
+        uint32_t padded = length + (4 - length % 4) % 4;
+        if (padded < length || padded > len - pos) {
+            error = "invalid record length";
+            return false;
+        }
+        const char *p = data + pos;
+        const char *end = p + length;
+        pos += padded;
+
+        if (kind == binary_symbols) {
+            if (length < 4) {
+                error = "invalid symbol record";
+                return false;
+            }
+            uint32_t count = get_word(p);
+            p += 4;
+            for (uint32_t i = 0; i < count; ++i) {
+                if (end - p < 4) {
+                    error = "invalid symbol record";
+                    return false;
+                }
+                uint32_t size = get_word(p);
+                p += 4;
+                uint32_t stored = size + (4 - size % 4) % 4;
+                if ((size_t)(end - p) < stored) {
+                    error = "invalid symbol record";
+                    return false;
+                }
+                symbols.push_back(std::make_pair(p, size));
+                p += stored;
+            }
+        } else if (kind == binary_commands) {
+            // items: atoms (symbol >= 0) and lists (whose children are
+            // kids[first, first+count))
+            items.clear();
+            kids.clear();
+            stack.clear();
+            while (p < end) {
+                uint32_t w;
+                if (!get_number(p, end, w)) {
+                    error = "truncated number";
+                    return false;
+                }
+                uint32_t x = w >> 1;
+                item it;
+                if (!(w & 1)) {
+                    if (x >= symbols.size()) {
+                        error = "invalid symbol index";
+                        return false;
+                    }
+                    it.symbol = x;
+                    it.first = it.count = 0;
+                } else {
+                    if (x > stack.size()) {
+                        error = "invalid list length";
+                        return false;
+                    }
+                    it.symbol = -1;
+                    it.first = kids.size();
+                    it.count = x;
+                    kids.insert(kids.end(), stack.end() - x, stack.end());
+                    stack.resize(stack.size() - x);
+                }
+                stack.push_back(items.size());
+                items.push_back(it);
+            }
+            for (size_t i = 0; i < stack.size(); ++i) {
+                print_item(items, kids, symbols, stack[i], out);
+                out << '\n';
+            }
+        } else {
+            error = "unknown record kind";
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace scrambler
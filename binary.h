@@ -0,0 +1,128 @@
+/* -*- C++ -*-
+ *
+ * Binary term output format (-format binary)
+ *
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#ifndef BINARY_H_INCLUDED
+#define BINARY_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace scrambler {
+
+/*
+ * The binary format encodes the S-expressions of the printed commands,
+ * with exactly the names and in exactly the order of the text output.
+ * Words are 32-bit little-endian integers, and records start at
+ * multiples of 4 bytes, so that the file can be mapped into memory and
+ * read in place:
+ *
+ *   file    := magic version record*
+ *   magic   := "SMTB"
+ *   version := 1 (a word)
+ *   record  := kind length payload padding
+ *
+ * where kind and length are words, length is the number of bytes of
+ * the payload, and padding (zero bytes) extends the payload to a
+ * multiple of 4 bytes.
+ *
+ * A record of kind binary_symbols appends to the symbol table, whose
+ * indices start at 0: a count (a word), then count times a byte length
+ * (a word), the bytes, and padding to the next multiple of 4.
+ *
+ * A record of kind binary_commands is a post-order stream of unsigned
+ * LEB128 numbers: (index << 1) is the atom with the given symbol table
+ * index, and (count << 1) | 1 is the list of the preceding count
+ * items. The items that remain at the end of the record are commands,
+ * in order; each is printed followed by a newline.
+ */
+const char binary_magic[4] = { 'S', 'M', 'T', 'B' };
+const uint32_t binary_version = 1;
+
+enum binary_record_kind {
+    binary_symbols = 1,
+    binary_commands = 2
+};
+
+/*
+ * Receives the text of commands (through the same operators as the
+ * text buffers that print_node writes to), and encodes its structure.
+ * Strings (i.e., symbols) are atoms; other text is split into atoms at
+ * parentheses and white space.
+ */
+class binary_encoder {
+public:
+    binary_encoder();
+
+    binary_encoder &operator<<(char c)
+    {
+        put(c);
+        return *this;
+    }
+    binary_encoder &operator<<(const char *s)
+    {
+        while (*s) {
+            put(*s++);
+        }
+        return *this;
+    }
+    binary_encoder &operator<<(const std::string &s)
+    {
+        atom.append(s);
+        return *this;
+    }
+    binary_encoder &operator<<(uint64_t x);
+
+    // the number of words encoded since the last call to write
+    size_t pending() const { return words.size(); }
+
+    // writes the commands encoded since the last call as records
+    void write(std::ostream &out);
+
+private:
+    void put(char c);
+    void end_atom();
+
+    std::string atom;
+    std::vector<uint32_t> counts;  // items in each open list
+    std::vector<uint32_t> words;
+    std::unordered_map<std::string, uint32_t> symbols;
+    std::vector<const std::string *> new_symbols;
+};
+
+// writes magic and version
+void write_binary_header(std::ostream &out);
+
+/*
+ * Converts data (a complete file in the binary format) back to text.
+ * Returns false (and sets error) if data is not well-formed.
+ */
+bool decode_binary(const char *data, size_t len, std::ostream &out,
+                   std::string &error);
+
+} // namespace scrambler
+
+#endif // BINARY_H_INCLUDED
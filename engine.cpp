@@ -0,0 +1,241 @@
+/* -*- C++ -*-
+ *
+ * Choice of how the input is processed (-engine auto)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "engine.h"
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <stdlib.h>
+#include <vector>
+
+namespace scrambler {
+
+namespace {
+
+// inputs below this size are printed faster than threads start up
+const uint64_t small_input = 1 << 20;
+
+// commands per segment below which segments are not printed in parallel
+const uint64_t min_parallel_commands = 1000;
+
+// stack space per level of term nesting (printing recurses once per
+// level; this includes a safety margin)
+const uint64_t stack_per_level = 256;
+
+const uint64_t megabyte = 1 << 20;
+
+} // namespace
+
+input_profile scan_input(int fd)
+{
+    input_profile p = { false, 0, 0, 0, 0 };
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        return p;
+    }
+
+    enum { code, in_string, in_quoted, in_comment } state = code;
+    uint64_t depth = 0;
+    // the symbol following the parenthesis that opens a command
+    std::string head;
+    bool in_head = false;
+    bool open_segment = false;
+    std::vector<char> buf(1 << 20);
+    off_t offset = 0;
+    for (;;) {
+        ssize_t n = pread(fd, buf.data(), buf.size(), offset);
+        if (n < 0) {
+            return p;
+        }
+        if (n == 0) {
+            break;
+        }
+        offset += n;
+        for (ssize_t i = 0; i < n; ++i) {
+            char c = buf[i];
+            switch (state) {
+            case in_string:
+                // an escaped quote ("") leaves and re-enters the literal
+                if (c == '"') {
+                    state = code;
+                }
+                continue;
+            case in_quoted:
+                if (c == '|') {
+                    state = code;
+                }
+                continue;
+            case in_comment:
+                if (c == '\n') {
+                    state = code;
+                }
+                continue;
+            case code:
+                break;
+            }
+            if (in_head) {
+                if (c == '(' || c == ')' || c == ' ' || c == '\t' ||
+                    c == '\n' || c == '\r' || c == ';' || c == '"' ||
+                    c == '|') {
+                    in_head = false;
+                    if (head == "check-sat") {
+                        ++p.segments;
+                        open_segment = false;
+                    }
+                } else if (head.size() < 16) {
+                    head.push_back(c);
+                }
+            }
+            if (c == '(') {
+                if (depth == 0) {
+                    ++p.commands;
+                    open_segment = true;
+                    head.clear();
+                    in_head = true;
+                }
+                ++depth;
+                p.max_depth = std::max(p.max_depth, depth);
+            } else if (c == ')') {
+                if (depth > 0) {
+                    --depth;
+                }
+            } else if (c == '"') {
+                state = in_string;
+            } else if (c == '|') {
+                state = in_quoted;
+            } else if (c == ';') {
+                state = in_comment;
+            }
+        }
+    }
+    if (open_segment) {
+        ++p.segments;
+    }
+    p.bytes = offset;
+    p.scanned = true;
+    return p;
+}
+
+engine_choice choose_engine(const input_profile &p, uint64_t memory_budget,
+                            size_t max_threads)
+{
+    engine_choice e = { 1, 0, "" };
+    std::ostringstream reason;
+    if (!p.scanned) {
+        e.reason = "input is not a regular file, defaults used";
+        return e;
+    }
+
+    uint64_t per_segment = p.commands / std::max<uint64_t>(p.segments, 1);
+    if (p.bytes < small_input) {
+        reason << "small input";
+    } else if (per_segment < min_parallel_commands) {
+        reason << "segments too small to print in parallel";
+    } else {
+        e.threads = std::max<size_t>(max_threads, 1);
+        reason << "large segments";
+    }
+
+    // the main thread's stack is limited by RLIMIT_STACK
+    struct rlimit rl;
+    uint64_t stack = 8 * megabyte;
+    if (getrlimit(RLIMIT_STACK, &rl) == 0) {
+        stack = rl.rlim_cur == RLIM_INFINITY ? UINT64_MAX : rl.rlim_cur;
+    }
+    uint64_t needed = stack_for_depth(p.max_depth);
+    if (needed > stack) {
+        // the stack is only reserved address space, but pages touched
+        // by deep recursion stay resident
+        uint64_t limit = memory_budget / 4;
+        e.stack_size = (size_t)std::min(needed, limit);
+        reason << ", deep terms need a " << (e.stack_size + megabyte - 1) / megabyte
+               << " MB stack";
+        if (needed > limit) {
+            reason << " (limited by the memory budget)";
+        }
+    }
+    e.reason = reason.str();
+    return e;
+}
+
+size_t stack_for_depth(uint64_t depth)
+{
+    return (size_t)(depth * stack_per_level + megabyte);
+}
+
+size_t current_stack_size()
+{
+    // (cached, since finding the main thread's stack reads /proc)
+    static thread_local size_t size = 0;
+    pthread_attr_t attr;
+    if (size == 0 && pthread_getattr_np(pthread_self(), &attr) == 0) {
+        pthread_attr_getstacksize(&attr, &size);
+        pthread_attr_destroy(&attr);
+    }
+    return size;
+}
+
+uint64_t physical_memory()
+{
+    long pages = sysconf(_SC_PHYS_PAGES);
+    long page_size = sysconf(_SC_PAGESIZE);
+    if (pages <= 0 || page_size <= 0) {
+        return UINT64_MAX;
+    }
+    return (uint64_t)pages * page_size;
+}
+
+namespace {
+
+void *run_fn(void *arg)
+{
+    (*(const std::function<void()> *)arg)();
+    return NULL;
+}
+
+} // namespace
+
+void run_with_stack(size_t stack_size, const std::function<void()> &fn)
+{
+    if (stack_size == 0) {
+        fn();
+        return;
+    }
+    pthread_attr_t attr;
+    pthread_t thread;
+    if (pthread_attr_init(&attr) != 0 ||
+        pthread_attr_setstacksize(&attr, stack_size) != 0 ||
+        pthread_create(&thread, &attr, run_fn, (void *)&fn) != 0) {
+        std::cerr << "ERROR creating a thread with a "
+                  << stack_size / megabyte << " MB stack" << std::endl;
+        exit(1);
+    }
+    pthread_attr_destroy(&attr);
+    pthread_join(thread, NULL);
+}
+
+} // namespace scrambler
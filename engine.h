@@ -0,0 +1,85 @@
+/* -*- C++ -*-
+ *
+ * Choice of how the input is processed (-engine auto)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#ifndef ENGINE_H_INCLUDED
+#define ENGINE_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+#include <functional>
+#include <string>
+
+namespace scrambler {
+
+/*
+ * What a cheap scan of the input (without parsing it) tells about it.
+ * Only regular files can be scanned, since the input must still be
+ * read by the parser afterwards.
+ */
+struct input_profile {
+    bool scanned;         // false if the input is not a regular file
+    uint64_t bytes;
+    uint64_t commands;    // top-level parenthesized expressions
+    uint64_t segments;    // check-sat commands, plus any trailing commands
+    uint64_t max_depth;   // maximum nesting of parentheses
+};
+
+// Scans the file open at fd, without changing its file offset.
+input_profile scan_input(int fd);
+
+/*
+ * How the input is processed: the number of threads (see -threads),
+ * and the stack size of the thread that parses and prints the
+ * benchmark, and of the worker threads that help it print (0 for the
+ * default stacks; printing recurses over terms, hence deeply nested
+ * terms need a large stack).
+ */
+struct engine_choice {
+    size_t threads;
+    size_t stack_size;
+    std::string reason;
+};
+
+/*
+ * Chooses the engine for the profiled input. Stacks are only enlarged
+ * within memory_budget (in bytes), and threads are limited to
+ * max_threads.
+ */
+engine_choice choose_engine(const input_profile &p, uint64_t memory_budget,
+                            size_t max_threads);
+
+// the stack size needed to print terms nested depth levels deep
+size_t stack_for_depth(uint64_t depth);
+
+// the stack size of the calling thread (0 if unknown)
+size_t current_stack_size();
+
+// the physical memory, used as the default budget
+uint64_t physical_memory();
+
+// Runs fn in a thread with the given stack size (or in the calling
+// thread if stack_size is 0), and waits for it to finish.
+void run_with_stack(size_t stack_size, const std::function<void()> &fn);
+
+} // namespace scrambler
+
+#endif // ENGINE_H_INCLUDED
@@ -0,0 +1,155 @@
+/* -*- C++ -*-
+ *
+ * Pull interface to the scrambled output
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "generator.h"
+#include <stdlib.h>
+#include <iostream>
+#include <streambuf>
+
+namespace scrambler {
+
+// the producer's stream buffer; full buffers are handed to the consumer
+class chunk_generator::channel_buf : public std::streambuf {
+public:
+    channel_buf(chunk_generator *gen, size_t size) : gen(gen), size(size) {
+        reset();
+    }
+
+protected:
+    int_type overflow(int_type c) {
+        hand_over();
+        if (c != traits_type::eof()) {
+            *pptr() = traits_type::to_char_type(c);
+            pbump(1);
+        }
+        return traits_type::not_eof(c);
+    }
+
+    int sync() {
+        hand_over();
+        return 0;
+    }
+
+private:
+    void hand_over() {
+        size_t len = pptr() - pbase();
+        if (len > 0) {
+            buf.resize(len);
+            gen->publish(buf);
+            reset();
+        }
+    }
+
+    void reset() {
+        buf.resize(size);
+        setp(&buf[0], &buf[0] + size);
+    }
+
+    chunk_generator *gen;
+    size_t size;
+    std::string buf;
+};
+
+chunk_generator::chunk_generator(const producer &produce, size_t buffer_size,
+                                 size_t stack_size)
+    : has_ready(false), done(false), cancelled(false),
+      buffer_size(buffer_size > 0 ? buffer_size : 1), produce(produce)
+{
+    // (std::thread cannot be given a stack size)
+    pthread_attr_t attr;
+    if (pthread_attr_init(&attr) != 0 ||
+        (stack_size > 0 && pthread_attr_setstacksize(&attr, stack_size) != 0) ||
+        pthread_create(&worker, &attr, start, this) != 0) {
+        std::cerr << "ERROR creating a thread with a "
+                  << stack_size / (1024 * 1024) << " MB stack" << std::endl;
+        exit(1);
+    }
+    pthread_attr_destroy(&attr);
+}
+
+chunk_generator::~chunk_generator()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        cancelled = true;
+    }
+    changed.notify_all();
+    pthread_join(worker, NULL);
+}
+
+bool chunk_generator::next(std::string &chunk)
+{
+    std::unique_lock<std::mutex> guard(lock);
+    changed.wait(guard, [this] { return has_ready || done; });
+    if (!has_ready) {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        return false;
+    }
+    chunk.swap(ready);
+    has_ready = false;
+    guard.unlock();
+    changed.notify_all();
+    return true;
+}
+
+void *chunk_generator::start(void *gen)
+{
+    ((chunk_generator *)gen)->run();
+    return NULL;
+}
+
+void chunk_generator::run()
+{
+    try {
+        channel_buf buf(this, buffer_size);
+        std::ostream out(&buf);
+        produce(out);
+        out.flush();
+    } catch (...) {
+        std::lock_guard<std::mutex> guard(lock);
+        error = std::current_exception();
+    }
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        done = true;
+    }
+    changed.notify_all();
+}
+
+void chunk_generator::publish(std::string &chunk)
+{
+    std::unique_lock<std::mutex> guard(lock);
+    // the producer is suspended while the previous chunk is pending
+    changed.wait(guard, [this] { return !has_ready || cancelled; });
+    if (cancelled) {
+        return;
+    }
+    ready.swap(chunk);
+    has_ready = true;
+    guard.unlock();
+    changed.notify_all();
+}
+
+} // namespace scrambler
@@ -0,0 +1,93 @@
+/* -*- C++ -*-
+ *
+ * Pull interface to the scrambled output
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#ifndef GENERATOR_H_INCLUDED
+#define GENERATOR_H_INCLUDED
+
+#include <pthread.h>
+#include <stddef.h>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <ostream>
+#include <string>
+
+namespace scrambler {
+
+/*
+ * Turns a producer that pushes its output into a stream (such as the
+ * scrambler's segment loop) into a generator that the consumer pulls
+ * chunks from, at its own pace.
+ *
+ * The producer runs in a thread of its own (with a stack of stack_size
+ * bytes, or the default stack of new threads if it is 0), and writes
+ * into a buffer of buffer_size bytes. Once that buffer is full (or the producer flushes
+ * the stream), the producer is suspended until the consumer has pulled
+ * the previous chunk. Hence the memory used for output is bounded by
+ * three buffers (the one being filled, the one waiting to be pulled,
+ * and the one last returned to the consumer), plus whatever the
+ * producer holds itself (e.g., the commands of the current segment).
+ *
+ * Exceptions thrown by the producer are rethrown by next().
+ */
+class chunk_generator {
+public:
+    typedef std::function<void(std::ostream &out)> producer;
+
+    chunk_generator(const producer &produce, size_t buffer_size,
+                    size_t stack_size = 0);
+
+    // If the output has not been pulled completely, the producer is run
+    // to completion, but its remaining output is discarded.
+    ~chunk_generator();
+
+    // Waits for the next chunk (of 1 to buffer_size bytes), and stores
+    // it in chunk. Returns false once the output is complete.
+    bool next(std::string &chunk);
+
+private:
+    class channel_buf;
+
+    chunk_generator(const chunk_generator &);
+    chunk_generator &operator=(const chunk_generator &);
+
+    static void *start(void *gen);
+    void run();
+    // called by the producer with a full chunk (which is swapped out)
+    void publish(std::string &chunk);
+
+    std::mutex lock;
+    std::condition_variable changed;
+    std::string ready;       // the chunk that has not been pulled yet
+    bool has_ready;
+    bool done;               // whether the producer has returned
+    bool cancelled;          // whether the consumer has gone away
+    std::exception_ptr error;
+    size_t buffer_size;
+    producer produce;
+    pthread_t worker;        // runs produce
+};
+
+} // namespace scrambler
+
+#endif // GENERATOR_H_INCLUDED
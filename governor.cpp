@@ -0,0 +1,243 @@
+/* -*- C++ -*-
+ *
+ * Memory and time budgets (-max-memory, -max-time)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "governor.h"
+#include "passes.h"
+#include <fcntl.h>
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+
+namespace scrambler {
+
+namespace {
+
+uint64_t max_memory = 0;
+uint64_t max_seconds = 0;
+double start_time = 0;
+// whether max_memory is still to be derived from the cgroup
+bool from_cgroup = false;
+
+// budgets are checked at most this often (in seconds), which makes
+// checks cheap enough for every segment boundary
+const double check_interval = 0.01;
+double last_check = 0;
+bool under_pressure = false;
+
+// the resident set size at which freed memory was last returned
+uint64_t trimmed_at = 0;
+
+// reads the (small) file at path; returns false if it cannot be read
+bool read_file(const char *path, std::string &contents)
+{
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    contents.clear();
+    char buf[4096];
+    ssize_t n;
+    while ((n = ::read(fd, buf, sizeof(buf))) > 0) {
+        contents.append(buf, n);
+    }
+    ::close(fd);
+    return n == 0;
+}
+
+// a limit read from a cgroup file: a number, or "max" (none)
+uint64_t read_limit(const std::string &path)
+{
+    std::string s;
+    if (!read_file(path.c_str(), s) || s.compare(0, 3, "max") == 0) {
+        return 0;
+    }
+    uint64_t limit = strtoull(s.c_str(), NULL, 10);
+    // cgroup v1 reports "no limit" as a huge number
+    return limit >= (1ULL << 60) ? 0 : limit;
+}
+
+// prints the reason as JSON, and ends the run (at once: the output is
+// incomplete anyway, and other threads may still be running)
+void fail(const char *reason, int code, uint64_t limit, uint64_t used,
+          double seconds, uint64_t commands)
+{
+    char line[256];
+    int len = snprintf(line, sizeof(line),
+                       "{\"reason\":\"%s\",\"limit\":%llu,\"used\":%llu,"
+                       "\"seconds\":%.3f,\"commands\":%llu}\n",
+                       reason, (unsigned long long)limit,
+                       (unsigned long long)used, seconds,
+                       (unsigned long long)commands);
+    if (len > 0 && write(STDERR_FILENO, line, len) < 0) {
+        // nothing left to report to
+    }
+    _exit(code);
+}
+
+void resolve_memory_budget()
+{
+    if (from_cgroup) {
+        max_memory = cgroup_memory_limit() / 10 * 9;
+        from_cgroup = false;
+    }
+}
+
+} // namespace
+
+void set_budgets(uint64_t memory_bytes, uint64_t seconds, double start)
+{
+    max_memory = memory_bytes;
+    max_seconds = seconds;
+    start_time = start;
+    last_check = start;
+    from_cgroup = false;
+}
+
+void use_cgroup_memory_budget()
+{
+    max_memory = 0;
+    from_cgroup = true;
+}
+
+uint64_t memory_budget()
+{
+    resolve_memory_budget();
+    return max_memory;
+}
+
+bool check_budgets(uint64_t commands)
+{
+    if (!max_memory && !max_seconds && !from_cgroup) {
+        return false;
+    }
+    double now = stats_clock();
+    if (now - last_check < check_interval) {
+        return under_pressure;
+    }
+    last_check = now;
+    resolve_memory_budget();
+    double seconds = now - start_time;
+    if (max_seconds && seconds > max_seconds) {
+        fail("max-time", exit_max_time, max_seconds, (uint64_t)seconds,
+             seconds, commands);
+    }
+    if (!max_memory) {
+        return false;
+    }
+    uint64_t used = resident_memory();
+    if (used > max_memory / 4 * 3 && used > trimmed_at + max_memory / 16) {
+        // memory that has been freed (e.g., by printed segments) may
+        // still be held by the allocator
+        malloc_trim(0);
+        used = resident_memory();
+        trimmed_at = used;
+    }
+    if (used > max_memory) {
+        fail("max-memory", exit_max_memory, max_memory, used, seconds,
+             commands);
+    }
+    under_pressure = used > max_memory / 4 * 3;
+    return under_pressure;
+}
+
+void check_stack_budget(uint64_t stack_bytes, uint64_t commands)
+{
+    resolve_memory_budget();
+    if (!max_memory) {
+        return;
+    }
+    uint64_t used = resident_memory() + stack_bytes;
+    if (used > max_memory) {
+        fail("max-memory", exit_max_memory, max_memory, used,
+             stats_clock() - start_time, commands);
+    }
+}
+
+uint64_t cgroup_memory_limit()
+{
+    std::string groups;
+    if (!read_file("/proc/self/cgroup", groups)) {
+        return 0;
+    }
+    // lines are "ID:CONTROLLERS:PATH"; cgroup v2 has ID 0 and no
+    // controllers. The path is relative to the mount point, unless the
+    // cgroup's root is the mount point (as in most containers).
+    size_t pos = 0;
+    while (pos < groups.size()) {
+        size_t end = groups.find('\n', pos);
+        if (end == std::string::npos) {
+            end = groups.size();
+        }
+        std::string line = groups.substr(pos, end - pos);
+        pos = end + 1;
+        size_t colon1 = line.find(':');
+        size_t colon2 = colon1 == std::string::npos ? std::string::npos
+                                                    : line.find(':', colon1 + 1);
+        if (colon2 == std::string::npos) {
+            continue;
+        }
+        std::string controllers = line.substr(colon1 + 1, colon2 - colon1 - 1);
+        std::string path = line.substr(colon2 + 1);
+        if (path == "/") {
+            path.clear();
+        }
+        uint64_t limit = 0;
+        if (controllers.empty()) {
+            limit = read_limit("/sys/fs/cgroup" + path + "/memory.max");
+            if (!limit && !path.empty()) {
+                limit = read_limit("/sys/fs/cgroup/memory.max");
+            }
+        } else if ((',' + controllers + ',').find(",memory,") !=
+                   std::string::npos) {
+            limit = read_limit("/sys/fs/cgroup/memory" + path +
+                               "/memory.limit_in_bytes");
+            if (!limit && !path.empty()) {
+                limit = read_limit("/sys/fs/cgroup/memory/memory.limit_in_bytes");
+            }
+        }
+        if (limit) {
+            return limit;
+        }
+    }
+    return 0;
+}
+
+uint64_t resident_memory()
+{
+    // /proc/self/statm: "size resident shared ..." in pages
+    std::string statm;
+    if (!read_file("/proc/self/statm", statm)) {
+        return 0;
+    }
+    const char *p = strchr(statm.c_str(), ' ');
+    if (!p) {
+        return 0;
+    }
+    static const uint64_t page_size = sysconf(_SC_PAGESIZE);
+    return strtoull(p + 1, NULL, 10) * page_size;
+}
+
+} // namespace scrambler
@@ -0,0 +1,82 @@
+/* -*- C++ -*-
+ *
+ * Memory and time budgets (-max-memory, -max-time)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#ifndef GOVERNOR_H_INCLUDED
+#define GOVERNOR_H_INCLUDED
+
+#include <stdint.h>
+
+namespace scrambler {
+
+/*
+ * The scrambler checks its budgets from inside, at segment boundaries
+ * (and every few thousand parsed commands, or printed batches), rather
+ * than being killed by the operating system: a run that exceeds a
+ * budget ends with one of the exit codes below, after printing a
+ * one-line JSON object with the reason to stderr, e.g.
+ *
+ *   {"reason":"max-memory","limit":1073741824,"used":1090519040,
+ *    "seconds":12.5,"commands":5000000}
+ *
+ * Memory use is the resident set size. Before it reaches the budget,
+ * check_budgets reports memory pressure, so that the caller can switch
+ * to a leaner strategy first.
+ */
+const int exit_max_memory = 3;
+const int exit_max_time = 4;
+
+// Sets the budgets (0: none). Times are measured from start, a
+// stats_clock() time (see passes.h).
+void set_budgets(uint64_t memory_bytes, uint64_t seconds, double start);
+
+// Makes the memory budget 90% of the cgroup's memory limit (if any).
+// The limit is only looked up when it is first needed, which runs that
+// end within the first check interval never do.
+void use_cgroup_memory_budget();
+
+// the memory budget in bytes (0 if none)
+uint64_t memory_budget();
+
+/*
+ * Ends the run if a budget is exceeded (commands is the number of
+ * commands parsed so far, for the reason). Returns true if memory use
+ * exceeds 3/4 of the budget, after freed memory has been returned to
+ * the operating system. Budgets are checked at most every 10 ms, and
+ * not during the first 10 ms (the result of the last check is returned
+ * in between); without budgets, this costs nothing.
+ */
+bool check_budgets(uint64_t commands);
+
+// Ends the run (as for max-memory) if a thread with a stack of
+// stack_bytes, which printing deeply nested terms needs, would not fit
+// into the memory budget next to the memory in use.
+void check_stack_budget(uint64_t stack_bytes, uint64_t commands);
+
+// the memory limit of the cgroup this process belongs to (0 if none)
+uint64_t cgroup_memory_limit();
+
+// the resident set size of this process in bytes
+uint64_t resident_memory();
+
+} // namespace scrambler
+
+#endif // GOVERNOR_H_INCLUDED
@@ -0,0 +1,119 @@
+/* -*- C++ -*-
+ *
+ * Index of the commands in the output (-emit-index)
+ *
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "index.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace scrambler {
+
+namespace {
+
+const size_t max_buffered = 1 << 20;
+
+void put(std::string &buf, uint64_t x, size_t bytes)
+{
+    for (size_t i = 0; i < bytes; ++i) {
+        buf.push_back((char)(x & 0xff));
+        x >>= 8;
+    }
+}
+
+} // namespace
+
+index_kind command_kind(const std::string &symbol)
+{
+    if (symbol == "assert") {
+        return index_assert;
+    } else if (symbol == "check-sat") {
+        return index_check_sat;
+    } else if (symbol.compare(0, 8, "declare-") == 0) {
+        return index_declare;
+    } else if (symbol.compare(0, 7, "define-") == 0) {
+        return index_define;
+    } else if (symbol == "push") {
+        return index_push;
+    } else if (symbol == "pop") {
+        return index_pop;
+    } else if (symbol == "set-logic") {
+        return index_set_logic;
+    }
+    return index_other;
+}
+
+bool index_writer::create(const char *path)
+{
+    fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) {
+        return false;
+    }
+    failed = false;
+    buf.assign("SMTI", 4);
+    put(buf, 1, 4);
+    return flush();
+}
+
+void index_writer::add(index_kind kind, uint32_t segment, uint64_t position,
+                       uint64_t offset, uint64_t length)
+{
+    put(buf, kind, 4);
+    put(buf, segment, 4);
+    put(buf, position, 8);
+    put(buf, offset, 8);
+    put(buf, length, 8);
+    if (buf.size() >= max_buffered) {
+        flush();
+    }
+}
+
+bool index_writer::flush()
+{
+    const char *data = buf.data();
+    size_t len = buf.size();
+    while (len > 0 && !failed) {
+        ssize_t n = ::write(fd, data, len);
+        if (n < 0) {
+            failed = errno != EINTR;
+            continue;
+        }
+        data += n;
+        len -= n;
+    }
+    buf.clear();
+    return !failed;
+}
+
+bool index_writer::close()
+{
+    if (fd < 0) {
+        return true;
+    }
+    bool ok = flush();
+    ok = ::close(fd) == 0 && ok;
+    fd = -1;
+    return ok;
+}
+
+} // namespace scrambler
@@ -0,0 +1,92 @@
+/* -*- C++ -*-
+ *
+ * Index of the commands in the output (-emit-index)
+ *
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#ifndef INDEX_H_INCLUDED
+#define INDEX_H_INCLUDED
+
+#include <stdint.h>
+#include <string>
+
+namespace scrambler {
+
+/*
+ * The index is a binary file: the magic "SMTI", a version (1), and one
+ * entry per printed command, in the order in which commands appear in
+ * the output. All integers are little-endian; an entry has 32 bytes:
+ *
+ *   uint32_t kind      (see index_kind)
+ *   uint32_t segment   (0 for the commands up to and including the
+ *                       first check-sat, 1 for the next segment, ...)
+ *   uint64_t position  (the command's position in the input, counting
+ *                       from 0, before commands were shuffled or sorted)
+ *   uint64_t offset    (of the command's first byte in the output)
+ *   uint64_t length    (in bytes, including the final newline)
+ *
+ * Commands that the scrambler inserts after check-sat (e.g., get-model)
+ * are part of the check-sat entry. The prelude (set-option commands
+ * that the scrambler prepends) is not indexed.
+ */
+enum index_kind {
+    index_other = 0,
+    index_assert = 1,
+    index_check_sat = 2,
+    index_declare = 3,  // declare-fun, declare-sort, declare-datatypes, ...
+    index_define = 4,   // define-fun, define-sort
+    index_push = 5,
+    index_pop = 6,
+    index_set_logic = 7
+};
+
+// the kind of a command, given its symbol
+index_kind command_kind(const std::string &symbol);
+
+class index_writer {
+public:
+    index_writer() : fd(-1), failed(false) {}
+    ~index_writer() { close(); }
+
+    // truncates the file at path, and writes the header; returns false
+    // on errors
+    bool create(const char *path);
+
+    bool is_open() const { return fd >= 0; }
+
+    void add(index_kind kind, uint32_t segment, uint64_t position,
+             uint64_t offset, uint64_t length);
+
+    // writes the buffered entries; returns false on errors
+    bool flush();
+
+    // flushes and closes the file; returns false on errors
+    bool close();
+
+private:
+    // a plain file descriptor: an unused writer costs nothing at startup
+    int fd;
+    bool failed;
+    std::string buf;
+};
+
+} // namespace scrambler
+
+#endif // INDEX_H_INCLUDED
@@ -0,0 +1,250 @@
+/* -*- C++ -*-
+ *
+ * A concurrent intern table for benchmark-declared names
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "intern.h"
+#include <assert.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+namespace scrambler {
+
+namespace {
+
+// marks the empty slots of an array that has been replaced by grow()
+intern_table::entry moved;
+
+} // namespace
+
+intern_table::intern_table(size_t capacity)
+    : current(NULL), count(0), new_entries(NULL)
+{
+    if (capacity > 0) {
+        reserve((capacity + 1) / 2);
+    }
+}
+
+intern_table::~intern_table()
+{
+    slot_array *a = current.load(std::memory_order_relaxed);
+    if (!a) {
+        return;
+    }
+    for (size_t i = 0; i <= a->mask; ++i) {
+        delete a->slots[i].load(std::memory_order_relaxed);
+    }
+    while (a) {
+        slot_array *replaced = a->replaced;
+        delete[] a->slots;
+        delete a;
+        a = replaced;
+    }
+}
+
+// FNV-1a
+uint64_t intern_table::hash_of(const char *name, size_t len)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; ++i) {
+        h ^= (unsigned char)name[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+intern_table::entry *intern_table::probe(const slot_array *a,
+                                         const char *name, size_t len,
+                                         uint64_t hash)
+{
+    if (!a) {
+        return NULL;
+    }
+    for (size_t i = hash & a->mask; ; i = (i + 1) & a->mask) {
+        entry *e = a->slots[i].load(std::memory_order_acquire);
+        // (an entry inserted after a moved slot was marked is in the
+        // new array only)
+        if (!e || e == &moved) {
+            return NULL;
+        }
+        if (e->hash == hash && e->name.size() == len &&
+            memcmp(e->name.data(), name, len) == 0) {
+            return e;
+        }
+    }
+}
+
+const intern_table::entry *intern_table::find(const char *name,
+                                              size_t len) const
+{
+    return probe(current.load(std::memory_order_acquire), name, len,
+                 hash_of(name, len));
+}
+
+intern_table::entry *intern_table::insert(const char *name, size_t len,
+                                          uint64_t order, bool *inserted)
+{
+    if (inserted) {
+        *inserted = false;
+    }
+    uint64_t h = hash_of(name, len);
+    entry *created = NULL;  // not yet visible to other threads
+    for (;;) {
+        slot_array *a = current.load(std::memory_order_acquire);
+        entry *e = NULL;
+        bool full = !a;
+        for (size_t i = a ? h & a->mask : 0, steps = 0; a; i = (i + 1) & a->mask) {
+            e = a->slots[i].load(std::memory_order_acquire);
+            if (!e) {
+                if (2 * (size() + 1) > a->mask + 1) {
+                    full = true;
+                    break;
+                }
+                if (!created) {
+                    created = new entry;
+                    created->name.assign(name, len);
+                    created->hash = h;
+                    created->order.store(order, std::memory_order_relaxed);
+                    created->id.store(0, std::memory_order_relaxed);
+                }
+                if (a->slots[i].compare_exchange_strong(e, created,
+                                                        std::memory_order_acq_rel,
+                                                        std::memory_order_acquire)) {
+                    count.fetch_add(1, std::memory_order_relaxed);
+                    created->next_new = new_entries.load(std::memory_order_relaxed);
+                    while (!new_entries.compare_exchange_weak(created->next_new, created,
+                                                              std::memory_order_release,
+                                                              std::memory_order_relaxed)) {
+                    }
+                    if (inserted) {
+                        *inserted = true;
+                    }
+                    return created;
+                }
+                // e is the entry of the thread that claimed the slot
+            }
+            if (e == &moved) {
+                break;
+            }
+            if (e->hash == h && e->name.size() == len &&
+                memcmp(e->name.data(), name, len) == 0) {
+                delete created;
+
+                // keep the smallest order key
+                uint64_t old = e->order.load(std::memory_order_relaxed);
+                while (order < old &&
+                       !e->order.compare_exchange_weak(old, order,
+                                                       std::memory_order_relaxed)) {
+                }
+                return e;
+            }
+            // (insertions that overshoot the load factor can fill the
+            // array)
+            if (++steps > a->mask) {
+                full = true;
+                break;
+            }
+        }
+
+        // the array is full, or being replaced: in both cases, the
+        // insertion is retried once a thread has grown the table
+        std::lock_guard<std::mutex> lock(grow_mutex);
+        if (full && current.load(std::memory_order_relaxed) == a) {
+            grow(a ? 2 * (a->mask + 1) : 0);
+        }
+    }
+}
+
+namespace {
+
+bool by_order(const intern_table::entry *a, const intern_table::entry *b)
+{
+    return a->order.load(std::memory_order_relaxed) <
+           b->order.load(std::memory_order_relaxed);
+}
+
+} // namespace
+
+void intern_table::assign_ids(uint64_t &next_id)
+{
+    std::vector<entry *> pending;
+    for (entry *e = new_entries.exchange(NULL, std::memory_order_acquire); e;
+         e = e->next_new) {
+        pending.push_back(e);
+    }
+    std::sort(pending.begin(), pending.end(), by_order);
+    for (size_t i = 0; i < pending.size(); ++i) {
+        pending[i]->id.store(next_id++, std::memory_order_release);
+        pending[i]->next_new = NULL;
+    }
+}
+
+void intern_table::reserve(size_t n)
+{
+    std::lock_guard<std::mutex> lock(grow_mutex);
+    const slot_array *a = current.load(std::memory_order_relaxed);
+    if (!a || 2 * n > a->mask + 1) {
+        size_t capacity = a ? a->mask + 1 : 1;
+        while (2 * n > capacity) {
+            capacity *= 2;
+        }
+        grow(capacity);
+    }
+}
+
+// called with grow_mutex held
+void intern_table::grow(size_t capacity)
+{
+    slot_array *old = current.load(std::memory_order_relaxed);
+    if (capacity < 16) {
+        capacity = 16;
+    }
+
+    slot_array *a = new slot_array;
+    a->mask = capacity - 1;
+    a->slots = new std::atomic<entry *>[capacity];
+    a->replaced = old;
+    for (size_t i = 0; i < capacity; ++i) {
+        a->slots[i].store(NULL, std::memory_order_relaxed);
+    }
+    for (size_t i = 0; old && i <= old->mask; ++i) {
+        // an empty slot is marked as moved, unless an insertion claims
+        // it first (then its entry is copied)
+        entry *e = old->slots[i].load(std::memory_order_acquire);
+        while (!e && !old->slots[i].compare_exchange_weak(e, &moved,
+                                                          std::memory_order_acq_rel,
+                                                          std::memory_order_acquire)) {
+        }
+        if (e) {
+            size_t j = e->hash & a->mask;
+            while (a->slots[j].load(std::memory_order_relaxed)) {
+                j = (j + 1) & a->mask;
+            }
+            a->slots[j].store(e, std::memory_order_relaxed);
+        }
+    }
+
+    // lookups that already loaded the old array keep probing it
+    current.store(a, std::memory_order_release);
+}
+
+} // namespace scrambler
@@ -0,0 +1,112 @@
+/* -*- C++ -*-
+ *
+ * A concurrent intern table for benchmark-declared names
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#ifndef INTERN_H_INCLUDED
+#define INTERN_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+
+namespace scrambler {
+
+/*
+ * A map from names to name ids that can be shared between threads.
+ *
+ * The table uses open addressing (linear probing) over an array of
+ * atomic entry pointers. Lookups and insertions do not lock: a new
+ * entry claims the first empty slot on its probe sequence with a
+ * compare-and-swap. Concurrent insertions of the same name race for
+ * the same slot, and the losers use the winner's entry.
+ *
+ * Each insertion carries an order key (e.g., the position of the
+ * declaration in the benchmark); an entry remembers the smallest key
+ * it was inserted with. Name ids of new entries are not handed out by
+ * insert(): assign_ids() numbers them in increasing key order, so the
+ * result does not depend on how insertions were interleaved.
+ *
+ * The table grows when it becomes more than half full; growing (and
+ * only growing) takes a mutex. It first marks every empty slot of the
+ * old array as moved, so that no insertion can claim one any more:
+ * insertions that reach a moved slot wait for the new array, and retry
+ * there. The slot arrays it replaces are only freed by the destructor,
+ * since concurrent lookups may still be probing them. Calling reserve()
+ * with the expected number of names avoids growing altogether.
+ */
+class intern_table {
+public:
+    struct entry {
+        std::string name;
+        uint64_t hash;
+        std::atomic<uint64_t> order;
+        std::atomic<uint64_t> id;  // 0 until assigned
+        entry *next_new;           // list of entries without an id
+    };
+
+    // with capacity 0, the slots are only allocated by the first
+    // insertion (or reserve)
+    explicit intern_table(size_t capacity = 1024);
+    ~intern_table();
+
+    // the entry for name, or NULL
+    const entry *find(const char *name, size_t len) const;
+
+    // the entry for name, which is created if it does not exist yet
+    // (inserted is set to true if this call created it)
+    entry *insert(const char *name, size_t len, uint64_t order,
+                  bool *inserted = NULL);
+
+    // assigns ids next_id, next_id+1, ... to all entries without an id,
+    // in increasing order of their order keys (not thread-safe)
+    void assign_ids(uint64_t &next_id);
+
+    // makes room for n names without growing
+    void reserve(size_t n);
+
+    size_t size() const { return count.load(std::memory_order_relaxed); }
+
+private:
+    intern_table(const intern_table &);
+    intern_table &operator=(const intern_table &);
+
+    struct slot_array {
+        size_t mask;
+        std::atomic<entry *> *slots;
+        slot_array *replaced;  // freed with this array
+    };
+
+    static uint64_t hash_of(const char *name, size_t len);
+    static entry *probe(const slot_array *a, const char *name, size_t len,
+                        uint64_t hash);
+    void grow(size_t capacity);
+
+    std::atomic<slot_array *> current;
+    std::atomic<size_t> count;
+    std::mutex grow_mutex;     // serializes growing
+    std::atomic<entry *> new_entries;
+};
+
+} // namespace scrambler
+
+#endif // INTERN_H_INCLUDED
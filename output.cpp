@@ -0,0 +1,350 @@
+/* -*- C++ -*-
+ *
+ * Output of the scrambled benchmark
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "output.h"
+#include "passes.h"
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <streambuf>
+
+namespace scrambler {
+
+namespace {
+
+// writes all of data to fd, exits on errors
+void write_all(int fd, const char *data, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = ::write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::cerr << "ERROR writing output" << std::endl;
+            exit(1);
+        }
+        data += n;
+        len -= n;
+    }
+}
+
+/*
+ * If the output is a pipe, buffers are not copied into the pipe, but
+ * handed to it with vmsplice: the pipe then refers to the buffer's
+ * pages. These must not change until the reader has consumed them, so
+ * the buffer is only ever filled front to back (flushing hands over
+ * the bytes written since the last flush), and is unmapped (but not
+ * reused) once it is full. If vmsplice is not supported, the output
+ * falls back to write.
+ */
+const size_t gift_size = 1 << 18;
+const int pipe_size = 1 << 20;
+
+// the bytes written (or mapped) so far, for other threads (see
+// written_output_bytes); not a member, so that it outlives the buffer
+std::atomic<uint64_t> published_bytes(0);
+
+class fd_buf : public std::streambuf {
+public:
+    explicit fd_buf(int fd) : fd(fd), mappable(false), splicing(false),
+                              written(0), first_write(0), gift(NULL),
+                              map_base(NULL), map_len(0) {
+        setp(buf, buf + sizeof(buf));
+        unsent = pbase();
+        struct stat st;
+        if (fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode)) {
+            // a larger pipe holds more buffers in flight (if permitted)
+            fcntl(fd, F_SETPIPE_SZ, pipe_size);
+            splicing = true;
+            new_gift();
+        }
+    }
+
+    ~fd_buf() {
+        sync();
+        stop_splicing();
+    }
+
+    bool open(const char *path) {
+        drain();
+        // mapping the file for writing requires read access
+        int new_fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0666);
+        if (new_fd < 0) {
+            return false;
+        }
+        stop_splicing();
+        struct stat st;
+        fd = new_fd;
+        mappable = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+        return true;
+    }
+
+    bool is_mappable() const {
+        return mappable;
+    }
+
+    char *reserve(uint64_t len) {
+        assert(mappable && !map_base);
+        drain();
+        if (len == 0) {
+            return NULL;
+        }
+        record_first_write();
+        // mappings start at page boundaries
+        static const uint64_t page_size = sysconf(_SC_PAGESIZE);
+        uint64_t start = written & ~(page_size - 1);
+        map_len = written + len - start;
+        if (ftruncate(fd, written + len) != 0) {
+            fail();
+        }
+        void *p = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+                       start);
+        if (p == MAP_FAILED) {
+            fail();
+        }
+        map_base = (char *)p;
+        char *result = map_base + (written - start);
+        written += len;
+        published_bytes.store(written, std::memory_order_relaxed);
+        return result;
+    }
+
+    void commit() {
+        if (!map_base) {
+            return;
+        }
+        if (msync(map_base, map_len, MS_ASYNC) != 0 ||
+            munmap(map_base, map_len) != 0) {
+            fail();
+        }
+        map_base = NULL;
+        // later writes go after the mapped bytes
+        if (lseek(fd, written, SEEK_SET) < 0) {
+            fail();
+        }
+    }
+
+    uint64_t bytes() const {
+        return written + (pptr() - unsent);
+    }
+
+    double first_output() const {
+        return first_write;
+    }
+
+protected:
+    int_type overflow(int_type c) {
+        drain();
+        if (c != traits_type::eof()) {
+            *pptr() = traits_type::to_char_type(c);
+            pbump(1);
+        }
+        return traits_type::not_eof(c);
+    }
+
+    std::streamsize xsputn(const char *s, std::streamsize n) {
+        if (!splicing && n > epptr() - pptr()) {
+            // large writes bypass the buffer
+            drain();
+            record_first_write();
+            write_all(fd, s, n);
+            written += n;
+            published_bytes.store(written, std::memory_order_relaxed);
+            return n;
+        }
+        std::streamsize left = n;
+        while (left > 0) {
+            std::streamsize len = std::min(left, (std::streamsize)(epptr() - pptr()));
+            traits_type::copy(pptr(), s, len);
+            pbump(len);
+            s += len;
+            left -= len;
+            if (left > 0) {
+                drain();
+            }
+        }
+        return n;
+    }
+
+    int sync() {
+        drain();
+        return 0;
+    }
+
+private:
+    void record_first_write() {
+        if (first_write == 0) {
+            first_write = stats_clock();
+        }
+    }
+
+    // writes the bytes in the buffer that have not been written yet
+    void drain() {
+        size_t len = pptr() - unsent;
+        if (len > 0) {
+            record_first_write();
+            if (splicing) {
+                splice_all(unsent, len);
+            } else {
+                write_all(fd, unsent, len);
+            }
+            written += len;
+            published_bytes.store(written, std::memory_order_relaxed);
+        }
+        if (!splicing) {
+            setp(buf, buf + sizeof(buf));
+            unsent = pbase();
+        } else if (pptr() == epptr()) {
+            new_gift();
+        } else {
+            unsent = pptr();
+        }
+    }
+
+    void splice_all(const char *data, size_t len) {
+        while (len > 0) {
+            struct iovec iov = { (void *)data, len };
+            ssize_t n = vmsplice(fd, &iov, 1, SPLICE_F_GIFT);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno == EINVAL || errno == ENOSYS || errno == EPERM) {
+                    // the rest is written, and the buffer replaced
+                    // by the next drain
+                    splicing = false;
+                    write_all(fd, data, len);
+                    return;
+                }
+                fail();
+            }
+            data += n;
+            len -= n;
+        }
+    }
+
+    // replaces the buffer by a fresh one; the old one may still be
+    // referenced by the pipe, which keeps its pages alive
+    void new_gift() {
+        if (gift) {
+            munmap(gift, gift_size);
+            gift = NULL;
+        }
+        void *p = mmap(NULL, gift_size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) {
+            splicing = false;
+            setp(buf, buf + sizeof(buf));
+        } else {
+            gift = (char *)p;
+            setp(gift, gift + gift_size);
+        }
+        unsent = pbase();
+    }
+
+    void stop_splicing() {
+        splicing = false;
+        if (gift) {
+            munmap(gift, gift_size);
+            gift = NULL;
+            setp(buf, buf + sizeof(buf));
+            unsent = pbase();
+        }
+    }
+
+    static void fail() {
+        std::cerr << "ERROR writing output" << std::endl;
+        exit(1);
+    }
+
+    int fd;
+    bool mappable;  // whether fd is a regular file
+    bool splicing;  // whether fd is a pipe that vmsplice works for
+    uint64_t written;
+    double first_write;
+    char *unsent;   // the bytes in [unsent, pptr()) have not been written
+    char *gift;     // the buffer handed to the pipe (if splicing)
+    char *map_base;  // the mapping made by reserve (if any)
+    uint64_t map_len;
+    char buf[1 << 16];
+};
+
+fd_buf &stdout_buf()
+{
+    static fd_buf b(STDOUT_FILENO);
+    return b;
+}
+
+} // namespace
+
+std::ostream &output()
+{
+    static std::ostream out(&stdout_buf());
+    return out;
+}
+
+uint64_t output_bytes()
+{
+    return stdout_buf().bytes();
+}
+
+uint64_t written_output_bytes()
+{
+    return published_bytes.load(std::memory_order_relaxed);
+}
+
+double first_output_time()
+{
+    return stdout_buf().first_output();
+}
+
+bool set_output_file(const char *path)
+{
+    return stdout_buf().open(path);
+}
+
+bool output_is_mapped()
+{
+    return stdout_buf().is_mappable();
+}
+
+char *reserve_output(uint64_t len)
+{
+    return stdout_buf().reserve(len);
+}
+
+void commit_output()
+{
+    stdout_buf().commit();
+}
+
+} // namespace scrambler
@@ -0,0 +1,66 @@
+/* -*- C++ -*-
+ *
+ * Output of the scrambled benchmark
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#ifndef OUTPUT_H_INCLUDED
+#define OUTPUT_H_INCLUDED
+
+#include <stdint.h>
+#include <ostream>
+
+namespace scrambler {
+
+/*
+ * The stream that the scrambled benchmark is written to (stdout, or
+ * the file given with -out). It is buffered independently of std::cout
+ * and only flushed explicitly (or when its buffer is full). It counts
+ * the bytes written, and records when the first byte was written.
+ */
+std::ostream &output();
+
+// number of bytes written to output() so far
+uint64_t output_bytes();
+
+// number of bytes written out of output()'s buffer so far (unlike
+// output_bytes, this may be called from any thread)
+uint64_t written_output_bytes();
+
+// stats_clock() time at which the first byte was written (0 if none)
+double first_output_time();
+
+// Makes the file at path (which is truncated) the output instead of
+// stdout. Returns false if it cannot be opened.
+bool set_output_file(const char *path);
+
+// whether the output is a regular file (and reserve_output may be used)
+bool output_is_mapped();
+
+/*
+ * Flushes output(), extends the output file by len bytes, and maps
+ * these into memory. The returned memory must be filled (possibly by
+ * several threads) before commit_output is called, which unmaps it.
+ */
+char *reserve_output(uint64_t len);
+void commit_output();
+
+} // namespace scrambler
+
+#endif // OUTPUT_H_INCLUDED
@@ -33,8 +33,11 @@
 #include "lexer.h"
 #include <limits.h>
 #include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
 #include <algorithm>
 #include <iostream>
+#include <sstream>
 #include <utility>
 
 #define YYMAXDEPTH LONG_MAX
@@ -48,6 +51,23 @@ extern bool support_non_smtcomp;
 
 extern bool support_z3;
 
+// Adds the command (s N) for N > 0; N must fit into 64 bits.
+static void add_repeated(const char *s, const char *numeral)
+{
+    errno = 0;
+    unsigned long long n = strtoull(numeral, NULL, 10);
+    if (errno == ERANGE) {
+        std::string msg = std::string(s) + " count out of range: " + numeral;
+        yyerror(msg.c_str());
+    }
+    if (n > 0) {
+        // the count is normalized (e.g., without leading zeros)
+        std::ostringstream count;
+        count << n;
+        add_node(s, make_node(count.str().c_str()));
+    }
+}
+
 %}
 
 %locations
@@ -343,20 +363,18 @@ cmd_exit : '(' TK_EXIT ')'
 
 cmd_pop : '(' TK_POP NUMERAL ')'
   {
-      // pop N is not allowed in SMT-COMP; rewrite it to repeated pop 1.
-      for (int i = atoi($3); i > 0; i--) {
-          add_node("pop", make_node("1"));
-      }
+      // pop N is not allowed in SMT-COMP; it is stored as one command,
+      // which is printed as N times pop 1 (see print_command).
+      add_repeated("pop", $3);
       free($3);
   }
 ;
 
 cmd_push : '(' TK_PUSH NUMERAL ')'
   {
-      // push N is not allowed in SMT-COMP; rewrite it to repeated push 1.
-      for (int i = atoi($3); i > 0; i--) {
-          add_node("push", make_node("1"));
-      }
+      // push N is not allowed in SMT-COMP; it is stored as one command,
+      // which is printed as N times push 1 (see print_command).
+      add_repeated("push", $3);
       free($3);
   }
 ;
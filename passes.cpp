@@ -0,0 +1,292 @@
+/* -*- C++ -*-
+ *
+ * Passes over the parse trees of commands, fused into single traversals
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "passes.h"
+#include "scheduler.h"
+#include <assert.h>
+#include <chrono>
+#include <iomanip>
+#include <mutex>
+#include <string>
+
+namespace scrambler {
+
+////////////////////////////////////////////////////////////////////////////////
+
+/*
+ * statistics (-stats)
+ */
+
+namespace {
+
+struct phase_stats {
+    std::string name;
+    double seconds;
+    uint64_t commands;
+    uint64_t nodes;
+};
+
+bool stats_enabled = false;
+std::vector<phase_stats> all_stats;
+std::mutex stats_lock;
+
+phase_stats &stats_for(const char *name)
+{
+    for (size_t i = 0; i < all_stats.size(); ++i) {
+        if (all_stats[i].name == name) {
+            return all_stats[i];
+        }
+    }
+    phase_stats s = { name, 0.0, 0, 0 };
+    all_stats.push_back(s);
+    return all_stats.back();
+}
+
+} // namespace
+
+void set_pass_stats(bool enabled)
+{
+    stats_enabled = enabled;
+}
+
+bool pass_stats_enabled()
+{
+    return stats_enabled;
+}
+
+double stats_clock()
+{
+    return std::chrono::duration<double>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void add_phase_time(const char *name, double seconds, uint64_t commands)
+{
+    std::lock_guard<std::mutex> guard(stats_lock);
+    phase_stats &s = stats_for(name);
+    s.seconds += seconds;
+    s.commands += commands;
+}
+
+void print_pass_stats(std::ostream &out)
+{
+    std::lock_guard<std::mutex> guard(stats_lock);
+    for (size_t i = 0; i < all_stats.size(); ++i) {
+        const phase_stats &s = all_stats[i];
+        out << "[stats] pass " << s.name << ": " << std::fixed
+            << std::setprecision(6) << s.seconds << " s, " << s.commands
+            << " commands";
+        if (s.nodes) {
+            out << ", " << s.nodes << " nodes";
+        }
+        out << std::endl;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+/*
+ * fused traversals
+ */
+
+namespace {
+
+const size_t max_fused = 32;
+
+bool conflict(const pass *a, const pass *b)
+{
+    return (a->writes & (b->reads | b->writes)) ||
+           (b->writes & (a->reads | a->writes));
+}
+
+// per-task counters, merged into all_stats at the end of a task
+struct group_stats {
+    std::vector<double> seconds;
+    std::vector<uint64_t> commands;
+    std::vector<uint64_t> nodes;
+
+    explicit group_stats(size_t k) : seconds(k, 0.0), commands(k, 0),
+                                     nodes(k, 0) {}
+};
+
+struct frame {
+    const node *n;
+    size_t next_child;
+    uint32_t active;  // passes that are visiting n
+};
+
+class fused_traversal {
+public:
+    fused_traversal(pass *const *group, size_t k, group_stats *stats)
+        : group(group), k(k), stats(stats) {}
+
+    void run(const node *cmd, size_t index) {
+        uint32_t mask = 0;
+        for (size_t p = 0; p < k; ++p) {
+            double start = stats ? stats_clock() : 0;
+            if (group[p]->begin_command(cmd, index)) {
+                mask |= 1U << p;
+                if (stats) {
+                    ++stats->commands[p];
+                }
+            }
+            if (stats) {
+                stats->seconds[p] += stats_clock() - start;
+            }
+        }
+        if (!mask) {
+            return;
+        }
+
+        // explicit stack: deep terms must not overflow the C++ stack
+        enter(cmd, mask, index);
+        while (!stack.empty()) {
+            frame &f = stack.back();
+            const node *n = f.n;
+            if (f.next_child < n->children.size()) {
+                size_t i = f.next_child++;
+                uint32_t child_mask = 0;
+                for (size_t p = 0; p < k; ++p) {
+                    if ((f.active & (1U << p)) && enter(n, i, p, index)) {
+                        child_mask |= 1U << p;
+                    }
+                }
+                if (child_mask) {
+                    enter(n->children[i], child_mask, index);
+                }
+            } else {
+                uint32_t active = f.active;
+                stack.pop_back();
+                for (size_t p = 0; p < k; ++p) {
+                    if (active & (1U << p)) {
+                        double start = stats ? stats_clock() : 0;
+                        group[p]->post(n, index);
+                        if (stats) {
+                            stats->seconds[p] += stats_clock() - start;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+private:
+    bool enter(const node *n, size_t i, size_t p, size_t index) {
+        if (!stats) {
+            return group[p]->enter_child(n, i, index);
+        }
+        double start = stats_clock();
+        bool result = group[p]->enter_child(n, i, index);
+        stats->seconds[p] += stats_clock() - start;
+        return result;
+    }
+
+    void enter(const node *n, uint32_t mask, size_t index) {
+        uint32_t active = 0;
+        for (size_t p = 0; p < k; ++p) {
+            if (mask & (1U << p)) {
+                double start = stats ? stats_clock() : 0;
+                if (group[p]->pre(n, index)) {
+                    active |= 1U << p;
+                }
+                if (stats) {
+                    stats->seconds[p] += stats_clock() - start;
+                    ++stats->nodes[p];
+                }
+            }
+        }
+        frame f = { n, 0, active };
+        stack.push_back(f);
+    }
+
+    pass *const *group;
+    size_t k;
+    group_stats *stats;
+    std::vector<frame> stack;
+};
+
+void merge_stats(pass *const *group, const group_stats &s)
+{
+    std::lock_guard<std::mutex> guard(stats_lock);
+    for (size_t p = 0; p < s.seconds.size(); ++p) {
+        phase_stats &t = stats_for(group[p]->name);
+        t.seconds += s.seconds[p];
+        t.commands += s.commands[p];
+        t.nodes += s.nodes[p];
+    }
+}
+
+void run_group(pass *const *group, size_t k, node *const *cmds, size_t n)
+{
+    // a group that only writes per-command state may run in parallel
+    bool independent = true;
+    for (size_t p = 0; p < k; ++p) {
+        if (group[p]->writes) {
+            independent = false;
+        }
+    }
+
+    range_fn visit = [&](size_t begin, size_t end) {
+        group_stats stats(k);
+        fused_traversal t(group, k, stats_enabled ? &stats : NULL);
+        for (size_t i = begin; i < end; ++i) {
+            t.run(cmds[i], i);
+        }
+        if (stats_enabled) {
+            merge_stats(group, stats);
+        }
+    };
+
+    if (independent) {
+        parallel_for(n, NULL, visit);
+    } else {
+        visit(0, n);
+    }
+}
+
+} // namespace
+
+void run_passes(const std::vector<pass *> &passes, node *const *cmds,
+                size_t n)
+{
+    size_t first = 0;
+    while (first < passes.size()) {
+        // extend the group while the next pass does not conflict with
+        // any pass in it
+        size_t last = first + 1;
+        while (last < passes.size() && last - first < max_fused) {
+            bool ok = true;
+            for (size_t p = first; p < last && ok; ++p) {
+                ok = !conflict(passes[p], passes[last]);
+            }
+            if (!ok) {
+                break;
+            }
+            ++last;
+        }
+        run_group(&passes[first], last - first, cmds, n);
+        first = last;
+    }
+}
+
+} // namespace scrambler
@@ -0,0 +1,93 @@
+/* -*- C++ -*-
+ *
+ * Passes over the parse trees of commands, fused into single traversals
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#ifndef PASSES_H_INCLUDED
+#define PASSES_H_INCLUDED
+
+#include "scrambler.h"
+#include <stdint.h>
+#include <ostream>
+#include <vector>
+
+namespace scrambler {
+
+/*
+ * State that passes read or write, besides their own. Passes whose
+ * effects do not conflict (i.e., neither writes what the other reads
+ * or writes) are fused: they share one traversal of each command.
+ */
+enum pass_effect {
+    effect_tree = 1,          // the parse trees themselves
+    effect_name_ids = 2,      // name_ids
+    effect_sorted_ids = 4,    // name_ids_sorted
+    effect_shared = 8         // any other state shared between commands
+};
+
+/*
+ * A pass visits the nodes of (some of) the commands in pre-order (pre)
+ * and post-order (post). A pass only sees the subtrees it enters: pre
+ * returning false, or enter_child returning false, prunes the
+ * traversal for this pass (but not for other passes fused with it).
+ *
+ * Passes that do not write effect_tree, effect_name_ids,
+ * effect_sorted_ids or effect_shared only write per-command state, and
+ * may visit different commands concurrently (see scheduler.h).
+ */
+class pass {
+public:
+    pass(const char *name, unsigned reads, unsigned writes)
+        : name(name), reads(reads), writes(writes) {}
+    virtual ~pass() {}
+
+    // begin_command(cmd, index) returns whether the pass visits cmd,
+    // and enter_child(n, i, index) whether it enters the i-th child of
+    // n; every hook receives the index of the command being visited
+    virtual bool begin_command(const node *, size_t) { return true; }
+    virtual bool pre(const node *, size_t) { return true; }
+    virtual bool enter_child(const node *, size_t, size_t) { return true; }
+    virtual void post(const node *, size_t) {}
+
+    const char *name;
+    unsigned reads;
+    unsigned writes;
+};
+
+// Runs the passes, in the given order, over commands cmds[0..n).
+void run_passes(const std::vector<pass *> &passes, node *const *cmds,
+                size_t n);
+
+// Timing of passes is recorded if enabled (see -stats).
+void set_pass_stats(bool enabled);
+bool pass_stats_enabled();
+
+// records the time of a phase that is not a tree pass (e.g., printing)
+void add_phase_time(const char *name, double seconds, uint64_t commands);
+
+// prints the time spent in each pass and phase, in order of first use
+void print_pass_stats(std::ostream &out);
+
+// seconds since some fixed point in time
+double stats_clock();
+
+} // namespace scrambler
+
+#endif // PASSES_H_INCLUDED
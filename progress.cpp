@@ -0,0 +1,196 @@
+/* -*- C++ -*-
+ *
+ * Progress lines for long runs (-progress)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "progress.h"
+#include "governor.h"
+#include "output.h"
+#include "passes.h"
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <streambuf>
+#include <thread>
+
+namespace scrambler {
+
+namespace {
+
+const int interval_ms = 1000;
+
+// bytes handed to the lexer (which reads through std::cin)
+std::atomic<uint64_t> input_bytes(0);
+
+// reads stdin for std::cin, counting the bytes read; the count is
+// ahead of the lexer by at most one buffer
+class counting_buf : public std::streambuf {
+protected:
+    int_type underflow() {
+        ssize_t n;
+        do {
+            n = ::read(STDIN_FILENO, buf, sizeof(buf));
+        } while (n < 0 && errno == EINTR);
+        if (n <= 0) {
+            return traits_type::eof();
+        }
+        setg(buf, buf, buf + n);
+        // only this thread writes the count
+        input_bytes.store(input_bytes.load(std::memory_order_relaxed) + n,
+                          std::memory_order_relaxed);
+        return traits_type::to_int_type(*gptr());
+    }
+
+private:
+    char buf[1 << 16];
+};
+
+// the sampler's state; it is never freed, since the process may exit
+// (e.g., on errors) while the sampler is running
+struct sampler {
+    int fd;
+    const std::atomic<uint64_t> *commands;
+    const std::atomic<uint32_t> *segment;
+    uint64_t input_size;  // 0 if stdin is not a regular file
+    double start;
+    double last_time;
+    uint64_t last_input;
+
+    std::mutex lock;
+    std::condition_variable wake;
+    bool stopping;
+    std::thread *thread;
+};
+
+sampler *current = NULL;
+
+// returns false if the line could not be written
+bool write_line(sampler &s, bool done)
+{
+    double now = stats_clock();
+    uint64_t in = input_bytes.load(std::memory_order_relaxed);
+    double rate = now > s.last_time ?
+        (in - s.last_input) / (now - s.last_time) / (1 << 20) : 0;
+    s.last_time = now;
+    s.last_input = in;
+
+    char line[512];
+    char size[64] = "";
+    if (s.input_size) {
+        snprintf(size, sizeof(size), "\"input_size\":%llu,",
+                 (unsigned long long)s.input_size);
+    }
+    int len = snprintf(line, sizeof(line),
+                       "{\"seconds\":%.3f,\"input_bytes\":%llu,%s"
+                       "\"commands\":%llu,\"segment\":%u,"
+                       "\"output_bytes\":%llu,\"mb_per_s\":%.1f,"
+                       "\"rss\":%llu,\"done\":%s}\n",
+                       now - s.start, (unsigned long long)in, size,
+                       (unsigned long long)s.commands->load(
+                           std::memory_order_relaxed),
+                       s.segment->load(std::memory_order_relaxed),
+                       (unsigned long long)written_output_bytes(), rate,
+                       (unsigned long long)resident_memory(),
+                       done ? "true" : "false");
+    const char *p = line;
+    while (len > 0) {
+        ssize_t n = ::write(s.fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+void run_sampler(sampler *s)
+{
+    // a reader that goes away must not end the run (with SIGPIPE)
+    sigset_t pipe_signal;
+    sigemptyset(&pipe_signal);
+    sigaddset(&pipe_signal, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipe_signal, NULL);
+
+    bool ok = true;
+    std::chrono::steady_clock::time_point next =
+        std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> guard(s->lock);
+    for (;;) {
+        next += std::chrono::milliseconds(interval_ms);
+        if (s->wake.wait_until(guard, next, [s] { return s->stopping; })) {
+            break;
+        }
+        if (ok) {
+            ok = write_line(*s, false);
+        }
+    }
+    if (ok) {
+        write_line(*s, true);
+    }
+}
+
+} // namespace
+
+void start_progress(int fd, const std::atomic<uint64_t> *commands,
+                    const std::atomic<uint32_t> *segment)
+{
+    std::cin.rdbuf(new counting_buf);
+
+    sampler *s = new sampler;
+    s->fd = fd;
+    s->commands = commands;
+    s->segment = segment;
+    struct stat st;
+    s->input_size = fstat(STDIN_FILENO, &st) == 0 && S_ISREG(st.st_mode) ?
+        st.st_size : 0;
+    s->start = stats_clock();
+    s->last_time = s->start;
+    s->last_input = 0;
+    s->stopping = false;
+    s->thread = new std::thread(run_sampler, s);
+    current = s;
+}
+
+void stop_progress()
+{
+    if (!current) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> guard(current->lock);
+        current->stopping = true;
+    }
+    current->wake.notify_one();
+    current->thread->join();
+    current = NULL;
+}
+
+} // namespace scrambler
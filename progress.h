@@ -0,0 +1,60 @@
+/* -*- C++ -*-
+ *
+ * Progress lines for long runs (-progress)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#ifndef PROGRESS_H_INCLUDED
+#define PROGRESS_H_INCLUDED
+
+#include <stdint.h>
+#include <atomic>
+
+namespace scrambler {
+
+/*
+ * With -progress FD, a sampling thread writes one line of JSON to FD
+ * every second, e.g.
+ *
+ *   {"seconds":2.000,"input_bytes":41943040,"input_size":1073741824,
+ *    "commands":812345,"segment":0,"output_bytes":0,"mb_per_s":20.0,
+ *    "rss":268435456,"done":false}
+ *
+ * input_bytes is the number of bytes the lexer has read from stdin
+ * (input_size is only given for regular files), and mb_per_s is the
+ * rate at which input was read during the last second; output_bytes
+ * counts the bytes written out of output()'s buffer. A last line with
+ * "done":true is written when the run ends normally.
+ *
+ * The sampler only reads counters that the parser and printer update
+ * anyway (as relaxed atomics), so the hot paths do not pay for it.
+ */
+
+// Starts the sampler; commands and segment are read by it. std::cin
+// must not have been read from yet: it is switched to a buffer that
+// counts the bytes read.
+void start_progress(int fd, const std::atomic<uint64_t> *commands,
+                    const std::atomic<uint32_t> *segment);
+
+// writes the last line, and stops the sampler (if it was started)
+void stop_progress();
+
+} // namespace scrambler
+
+#endif // PROGRESS_H_INCLUDED
@@ -0,0 +1,326 @@
+/* -*- C++ -*-
+ *
+ * A work-stealing task scheduler for per-command passes
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "scheduler.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct task {
+    size_t begin;
+    size_t end;
+};
+
+// Each worker owns a deque of tasks: the owner pushes and pops at the
+// back, thieves take from the front (i.e., the oldest and typically
+// largest tasks).
+struct task_queue {
+    std::mutex lock;
+    std::deque<task> tasks;
+};
+
+class work_stealing_pool {
+public:
+    work_stealing_pool() : num_workers(1), stack_size(0), generation(0),
+                           shutting_down(false), fn(NULL), weights(NULL),
+                           grain(1), remaining(0) {
+        queues.push_back(new task_queue);
+    }
+
+    ~work_stealing_pool() {
+        stop();
+        for (size_t i = 0; i < queues.size(); ++i) {
+            delete queues[i];
+        }
+    }
+
+    void resize(size_t n, size_t stack) {
+        if (n == 0) {
+            n = 1;
+        }
+        if (n == num_workers && stack == stack_size) {
+            return;
+        }
+        stop();
+        for (size_t i = 0; i < queues.size(); ++i) {
+            delete queues[i];
+        }
+        queues.clear();
+        for (size_t i = 0; i < n; ++i) {
+            queues.push_back(new task_queue);
+        }
+        num_workers = n;
+        stack_size = stack;
+        shutting_down = false;
+        // worker 0 is the thread calling run()
+        for (size_t i = 1; i < n; ++i) {
+            threads.push_back(start_worker(i));
+        }
+    }
+
+    size_t size() const { return num_workers; }
+    size_t worker_stack_size() const { return stack_size; }
+
+    void run(size_t n, const uint64_t *w, const scrambler::range_fn &f) {
+        if (n == 0) {
+            return;
+        }
+
+        // prefix sums of the weights, so that the weight of any range
+        // (and its weighted midpoint) can be found quickly
+        prefix.clear();
+        if (w) {
+            prefix.resize(n + 1);
+            prefix[0] = 0;
+            for (size_t i = 0; i < n; ++i) {
+                prefix[i + 1] = prefix[i] + std::max<uint64_t>(w[i], 1);
+            }
+        }
+        uint64_t total = w ? prefix[n] : n;
+        // a few tasks per worker to even out imbalance
+        grain = std::max<uint64_t>(total / (num_workers * 8), 1);
+        weights = w ? &prefix : NULL;
+        fn = &f;
+        remaining.store(n);
+
+        push(0, task{0, n});
+        {
+            std::lock_guard<std::mutex> guard(state_lock);
+            ++generation;
+        }
+        wake.notify_all();
+
+        work(0);
+
+        fn = NULL;
+        weights = NULL;
+    }
+
+private:
+    uint64_t weight_of(const task &t) const {
+        if (!weights) {
+            return t.end - t.begin;
+        }
+        return (*weights)[t.end] - (*weights)[t.begin];
+    }
+
+    size_t midpoint(const task &t) const {
+        assert(t.end - t.begin > 1);
+        if (!weights) {
+            return t.begin + (t.end - t.begin) / 2;
+        }
+        uint64_t half = ((*weights)[t.begin] + (*weights)[t.end]) / 2;
+        size_t mid = std::lower_bound(weights->begin() + t.begin,
+                                      weights->begin() + t.end, half) -
+                     weights->begin();
+        return std::min(std::max(mid, t.begin + 1), t.end - 1);
+    }
+
+    void push(size_t self, const task &t) {
+        std::lock_guard<std::mutex> guard(queues[self]->lock);
+        queues[self]->tasks.push_back(t);
+    }
+
+    bool pop(size_t self, task &t) {
+        std::lock_guard<std::mutex> guard(queues[self]->lock);
+        if (queues[self]->tasks.empty()) {
+            return false;
+        }
+        t = queues[self]->tasks.back();
+        queues[self]->tasks.pop_back();
+        return true;
+    }
+
+    bool steal(size_t self, task &t) {
+        for (size_t k = 1; k < num_workers; ++k) {
+            task_queue *victim = queues[(self + k) % num_workers];
+            std::lock_guard<std::mutex> guard(victim->lock);
+            if (!victim->tasks.empty()) {
+                t = victim->tasks.front();
+                victim->tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void execute(size_t self, task t) {
+        // split off the upper half for thieves while the task is too big
+        while (t.end - t.begin > 1 && weight_of(t) > grain) {
+            size_t mid = midpoint(t);
+            push(self, task{mid, t.end});
+            t.end = mid;
+        }
+        (*fn)(t.begin, t.end);
+        remaining.fetch_sub(t.end - t.begin);
+    }
+
+    void work(size_t self) {
+        task t;
+        while (remaining.load() > 0) {
+            if (pop(self, t) || steal(self, t)) {
+                execute(self, t);
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    struct worker_start {
+        work_stealing_pool *pool;
+        size_t self;
+    };
+
+    static void *worker_entry(void *arg) {
+        worker_start *start = (worker_start *)arg;
+        start->pool->worker_main(start->self);
+        delete start;
+        return NULL;
+    }
+
+    // std::thread cannot be given a stack size, hence workers are
+    // created with pthreads
+    pthread_t start_worker(size_t self) {
+        pthread_attr_t attr;
+        pthread_t thread;
+        worker_start *start = new worker_start;
+        start->pool = this;
+        start->self = self;
+        if (pthread_attr_init(&attr) != 0 ||
+            (stack_size > 0 &&
+             pthread_attr_setstacksize(&attr, stack_size) != 0) ||
+            pthread_create(&thread, &attr, worker_entry, start) != 0) {
+            std::cerr << "ERROR creating a worker thread with a "
+                      << stack_size / (1024 * 1024) << " MB stack"
+                      << std::endl;
+            exit(1);
+        }
+        pthread_attr_destroy(&attr);
+        return thread;
+    }
+
+    void worker_main(size_t self) {
+        uint64_t seen = 0;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> guard(state_lock);
+                while (!shutting_down && generation == seen) {
+                    wake.wait(guard);
+                }
+                if (shutting_down) {
+                    return;
+                }
+                seen = generation;
+            }
+            work(self);
+        }
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> guard(state_lock);
+            shutting_down = true;
+        }
+        wake.notify_all();
+        for (size_t i = 0; i < threads.size(); ++i) {
+            pthread_join(threads[i], NULL);
+        }
+        threads.clear();
+    }
+
+    size_t num_workers;
+    size_t stack_size;  // of the workers; 0 for the default
+    std::vector<task_queue *> queues;
+    std::vector<pthread_t> threads;
+
+    std::mutex state_lock;
+    std::condition_variable wake;
+    uint64_t generation;
+    bool shutting_down;
+
+    // the current parallel_for
+    const scrambler::range_fn *fn;
+    const std::vector<uint64_t> *weights;
+    std::vector<uint64_t> prefix;
+    uint64_t grain;
+    std::atomic<size_t> remaining;
+};
+
+work_stealing_pool &pool()
+{
+    static work_stealing_pool p;
+    return p;
+}
+
+} // namespace
+
+namespace scrambler {
+
+void set_num_threads(size_t n)
+{
+    pool().resize(n, pool().worker_stack_size());
+}
+
+void set_worker_stack_size(size_t bytes)
+{
+    pool().resize(pool().size(), bytes);
+}
+
+size_t get_worker_stack_size()
+{
+    size_t size = pool().worker_stack_size();
+    pthread_attr_t attr;
+    if (size == 0 && pthread_attr_init(&attr) == 0) {
+        pthread_attr_getstacksize(&attr, &size);
+        pthread_attr_destroy(&attr);
+    }
+    return size;
+}
+
+size_t get_num_threads()
+{
+    return pool().size();
+}
+
+void parallel_for(size_t n, const uint64_t *weights, const range_fn &fn)
+{
+    if (pool().size() == 1 || n < 2) {
+        if (n > 0) {
+            fn(0, n);
+        }
+        return;
+    }
+    pool().run(n, weights, fn);
+}
+
+} // namespace scrambler
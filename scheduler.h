@@ -0,0 +1,65 @@
+/* -*- C++ -*-
+ *
+ * A work-stealing task scheduler for per-command passes
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#ifndef SCHEDULER_H_INCLUDED
+#define SCHEDULER_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+#include <functional>
+
+namespace scrambler {
+
+/*
+ * Passes that handle each command of a segment independently (e.g.,
+ * printing, or extracting :named annotations) can hand the index range
+ * [0, n) of those commands to parallel_for. The range is split into
+ * tasks that are distributed over the worker threads; idle workers
+ * steal tasks from busy ones.
+ *
+ * Task granularity is chosen from per-index weights (typically subtree
+ * sizes): a task is split in two (at its weighted midpoint) while its
+ * total weight exceeds the grain size. Without weights, every index
+ * counts as 1.
+ *
+ * Callers must ensure that fn(begin, end) only writes state that
+ * belongs to the indices in [begin, end), so that results do not
+ * depend on the number of threads or on the order in which tasks run.
+ */
+
+typedef std::function<void(size_t begin, size_t end)> range_fn;
+
+// number of threads used by parallel_for (including the calling thread)
+void set_num_threads(size_t n);
+size_t get_num_threads();
+
+// stack size (in bytes) of the worker threads, which run fn just like
+// the calling thread does (0 for the default size of new threads)
+void set_worker_stack_size(size_t bytes);
+size_t get_worker_stack_size();
+
+// weights (may be NULL) points to n weights, one per index
+void parallel_for(size_t n, const uint64_t *weights, const range_fn &fn);
+
+} // namespace scrambler
+
+#endif // SCHEDULER_H_INCLUDED
@@ -29,7 +29,21 @@
  */
 
 #include "scrambler.h"
+#include "binary.h"
+#include "engine.h"
+#include "generator.h"
+#include "governor.h"
+#include "index.h"
+#include "intern.h"
+#include "output.h"
+#include "passes.h"
+#include "progress.h"
+#include "scheduler.h"
+#include "shuffle.h"
 #include <sstream>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <time.h>
@@ -41,10 +55,14 @@
 #include <assert.h>
 #include <ctype.h>
 #include <stack>
+#include <deque>
+#include <atomic>
 #include <unordered_map>
 #include <map>
 #include <unordered_set>
 #include <vector>
+#include <thread>
+#include <unistd.h>
 #include <ranges>
 #include <algorithm>
 
@@ -64,10 +82,39 @@ void set_seed(int s)
     seed = s;
 }
 
+// the same generator, with its state in state rather than seed
+size_t next_rand_int(uint64_t &state, size_t upper_bound)
+{
+    state = ((state * a) + c) & mask;
+    return (size_t)(state >> 16U) % upper_bound;
+}
+
 size_t next_rand_int(size_t upper_bound)
 {
-    seed = ((seed * a) + c) & mask;
-    return (size_t)(seed >> 16U) % upper_bound;
+    return next_rand_int(seed, upper_bound);
+}
+
+/*
+ * If set, permutations are generated by MergeShuffle (see shuffle.h),
+ * which uses all threads, rather than by Fisher-Yates. Its seed is
+ * drawn from the generator above, so that the result is deterministic.
+ *
+ * print_ranked orders assertions, declarations and names without
+ * random permutations; only the lists that the parser shuffles (let
+ * bindings and datatype constructors) and print_scrambled use these.
+ */
+bool parallel_shuffle = false;
+
+template <class T>
+void shuffle_range(T *a, size_t n)
+{
+    if (parallel_shuffle) {
+        scrambler::merge_shuffle(a, n, next_rand_int(SIZE_MAX));
+    } else {
+        for (size_t i = n-1; i > 0; --i) {
+            std::swap(a[i], a[next_rand_int(i+1)]);
+        }
+    }
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -131,6 +178,12 @@ bool support_z3 = false;
  */
 bool count_asrts = false;
 
+/*
+ * If set to true, the output is in the binary format of binary.h rather
+ * than SMT-LIB text.
+ */
+bool binary_format = false;
+
 /*
     stores the name of the query intended to be fed into the 
 */
@@ -156,10 +209,12 @@ std::string ranks_file_name;
  * is otherwise also used to store SMT-LIB commands, keywords, etc.).
  *
  * In addition, a bijection between benchmark-declared names and name
- * identifiers is built during parsing, and extended whenever a
- * declaration or binder (of a new name) is encountered. Note that
- * name identifiers are not necessarily unique, i.e., they do not
- * resolve shadowing.
+ * identifiers is built, and extended whenever a declaration or binder
+ * (of a new name) is encountered. During parsing, new names are only
+ * interned (see intern.h); they receive their name identifiers, in
+ * order of their first declaration, before the benchmark is printed.
+ * Note that name identifiers are not necessarily unique, i.e., they do
+ * not resolve shadowing.
  *
  * Finally, when the scrambled benchmark is printed, name identifiers
  * are permuted randomly before they are turned into uniform names.
@@ -167,8 +222,9 @@ std::string ranks_file_name;
 
 typedef std::unordered_map<std::string, uint64_t> Name_ID_Map;
 
-// a map from benchmark-declared symbols to name identifiers
-Name_ID_Map name_ids;
+// a map from benchmark-declared symbols to name identifiers (allocated
+// by the first declaration)
+scrambler::intern_table name_ids(0);
 
 // |foo| and foo denote the same symbol in SMT-LIB, hence the need to
 // remove |...| quotes before symbol lookups
@@ -187,29 +243,66 @@ const char *unquote(const char *n)
     return buf.c_str();
 }
 
+// same as unquote, but without copying (and thus thread-safe)
+void strip_quotes(const char *&n, size_t &len)
+{
+    if (len > 1 && n[0] == '|' && n[len-1] == '|') {
+        ++n;
+        len -= 2;
+    }
+}
+
 // the next available name id
 uint64_t next_name_id = 1;
 
+// the number of declarations (of new or existing names) seen so far,
+// which orders names by their first declaration
+uint64_t num_declarations = 0;
+
 namespace scrambler {
 
 // declaring a new name
 void set_new_name(const char *n)
 {
-    n = unquote(n);
-
-    if (name_ids.find(n) == name_ids.end()) {
-        name_ids[n] = next_name_id;
-        ++next_name_id;
-    }
+    size_t len = strlen(n);
+    strip_quotes(n, len);
+    name_ids.insert(n, len, num_declarations++);
 }
 
 } // namespace
 
-uint64_t get_name_id(const char *n)
+// gives name ids to the names declared since the last call
+void assign_name_ids()
+{
+    name_ids.assign_ids(next_name_id);
+}
+
+// Lookups do not modify name_ids (unlike name_ids[n]), and do not use
+// the static buffer of unquote, so that they are safe to call from
+// several threads while printing.
+uint64_t lookup_name_id(const Name_ID_Map &ids, const std::string &n)
+{
+    Name_ID_Map::const_iterator it;
+    if (n.size() > 1 && n[0] == '|' && n[n.size()-1] == '|') {
+        it = ids.find(n.substr(1, n.size()-2));
+    } else {
+        it = ids.find(n);
+    }
+    return it == ids.end() ? 0 : it->second;  // 0 if n is not in ids
+}
+
+uint64_t lookup_name_id(const scrambler::intern_table &ids, const std::string &n)
 {
-    n = unquote(n);
+    const char *p = n.data();
+    size_t len = n.size();
+    strip_quotes(p, len);
+    const scrambler::intern_table::entry *e = ids.find(p, len);
+    return e ? e->id.load(std::memory_order_acquire) : 0;
+}
 
-    return name_ids[n];  // 0 if n is not currently in name_ids
+uint64_t get_name_id(const std::string &n)
+{
+    return lookup_name_id(name_ids, n);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -231,6 +324,28 @@ void node::add_children(const std::vector<node *> *c)
  */
 std::vector<scrambler::node *> commands;
 
+/*
+ * -max-memory and -max-time: the budgets are checked (see governor.h)
+ * at segment boundaries, between printed batches, and every
+ * commands_per_check parsed commands. Under memory pressure, commands
+ * are printed by a single thread, which renders them directly into the
+ * output instead of buffering rendered batches.
+ */
+const uint64_t commands_per_check = 4096;
+// (read by the -progress sampler, see progress.h)
+std::atomic<uint64_t> num_added(0);
+// the number of commands parsed when printing fell back to one thread
+uint64_t degraded_at = 0;
+
+static void govern()
+{
+    if (scrambler::check_budgets(num_added) &&
+        scrambler::get_num_threads() > 1) {
+        scrambler::set_num_threads(1);
+        degraded_at = num_added;
+    }
+}
+
 namespace scrambler {
 
 void add_node(const char *s, node *n1, node *n2, node *n3, node *n4)
@@ -256,6 +371,12 @@ void add_node(const char *s, node *n1, node *n2, node *n3, node *n4)
     }
 
     commands.push_back(ret);
+    // only the parser writes num_added: no atomic increment is needed
+    uint64_t added = num_added.load(std::memory_order_relaxed) + 1;
+    num_added.store(added, std::memory_order_relaxed);
+    if (added % commands_per_check == 0) {
+        govern();
+    }
 }
 
 node *make_node(const char *s, node *n1, node *n2)
@@ -329,11 +450,8 @@ namespace scrambler {
 
 void shuffle_list(std::vector<scrambler::node *> *v, size_t start, size_t end)
 {
-    if (!no_scramble) {
-        size_t n = end - start;
-        for (size_t i = n-1; i > 0; --i) {
-            std::swap((*v)[i+start], (*v)[next_rand_int(i+1)+start]);
-        }
+    if (!no_scramble && end - start > 1) {
+        shuffle_range(v->data() + start, end - start);
     }
 }
 
@@ -593,23 +711,175 @@ bool flip_antisymm(const node *n, node ** const out_n)
 // a random permutation of name ids
 std::vector<uint64_t> permuted_name_ids;
 
-// uniform names
-std::string make_name(uint64_t name_id)
-{
-    std::ostringstream tmp;
-    tmp << "x" << name_id;
-    return tmp.str();
-}
+/*
+ * How benchmark-declared names are printed: interned (or ids) maps them
+ * to name ids, which are mapped through permutation (if not NULL) before
+ * they are turned into uniform names.
+ */
+struct naming {
+    const scrambler::intern_table *interned;  // if NULL, ids is used
+    const Name_ID_Map *ids;
+    const std::vector<uint64_t> *permutation;
+    // if not NULL, names that are not in ids are added to it with name
+    // id 0 after printing (so that they are not renamed later on; this
+    // is what get_name_id_sorted does)
+    Name_ID_Map *record_unknown;
+};
+
+// encodes the output if binary_format is set
+scrambler::binary_encoder binary_out;
+
+// annotated assertions (for -gen-unsat-core true) are named smtcomp1,
+// smtcomp2, ... in the order in which they are printed
+uint64_t next_annotation_id = 1;
 
-// annotated assertions (for -gen-unsat-core true)
-std::string make_annotation_name()
-{
-    static uint64_t n = 1;
-    std::ostringstream tmp;
-    tmp << "smtcomp" << n;
-    ++n;
-    return tmp.str();
-}
+/*
+ * Commands are rendered into a text buffer before they are written to
+ * the output stream, so that independent commands can be rendered
+ * concurrently (see -threads).
+ */
+class text_buffer {
+public:
+    text_buffer &operator<<(char c)
+    {
+        buf.push_back(c);
+        return *this;
+    }
+    text_buffer &operator<<(const char *s)
+    {
+        buf.append(s);
+        return *this;
+    }
+    text_buffer &operator<<(const std::string &s)
+    {
+        buf.append(s);
+        return *this;
+    }
+    text_buffer &operator<<(uint64_t x)
+    {
+        char tmp[20];
+        size_t len = 0;
+        do {
+            tmp[len++] = '0' + (x % 10);
+            x /= 10;
+        } while (x);
+        while (len) {
+            buf.push_back(tmp[--len]);
+        }
+        return *this;
+    }
+
+    std::string buf;
+};
+
+// counts the characters that a text_buffer would receive
+class text_length {
+public:
+    text_length() : len(0) {}
+
+    text_length &operator<<(char)
+    {
+        ++len;
+        return *this;
+    }
+    text_length &operator<<(const char *s)
+    {
+        len += strlen(s);
+        return *this;
+    }
+    text_length &operator<<(const std::string &s)
+    {
+        len += s.size();
+        return *this;
+    }
+    text_length &operator<<(uint64_t x)
+    {
+        do {
+            ++len;
+            x /= 10;
+        } while (x);
+        return *this;
+    }
+
+    uint64_t len;
+};
+
+// writes text into memory that has been sized with text_length
+class text_writer {
+public:
+    explicit text_writer(char *p) : p(p) {}
+
+    text_writer &operator<<(char c)
+    {
+        *p++ = c;
+        return *this;
+    }
+    text_writer &operator<<(const char *s)
+    {
+        size_t len = strlen(s);
+        memcpy(p, s, len);
+        p += len;
+        return *this;
+    }
+    text_writer &operator<<(const std::string &s)
+    {
+        memcpy(p, s.data(), s.size());
+        p += s.size();
+        return *this;
+    }
+    text_writer &operator<<(uint64_t x)
+    {
+        char tmp[20];
+        size_t len = 0;
+        do {
+            tmp[len++] = '0' + (x % 10);
+            x /= 10;
+        } while (x);
+        while (len) {
+            *p++ = tmp[--len];
+        }
+        return *this;
+    }
+
+    char *p;
+};
+
+// writes text directly into a stream buffer (e.g., that of output())
+class stream_writer {
+public:
+    explicit stream_writer(std::streambuf *sb) : sb(sb) {}
+
+    stream_writer &operator<<(char c)
+    {
+        sb->sputc(c);
+        return *this;
+    }
+    stream_writer &operator<<(const char *s)
+    {
+        sb->sputn(s, strlen(s));
+        return *this;
+    }
+    stream_writer &operator<<(const std::string &s)
+    {
+        sb->sputn(s.data(), s.size());
+        return *this;
+    }
+    stream_writer &operator<<(uint64_t x)
+    {
+        char tmp[20];
+        size_t len = 0;
+        do {
+            tmp[len++] = '0' + (x % 10);
+            x /= 10;
+        } while (x);
+        while (len) {
+            sb->sputc(tmp[--len]);
+        }
+        return *this;
+    }
+
+    std::streambuf *sb;
+};
 
 static bool keep_annotation(const scrambler::node *n, annotation_mode keep_annotations) {
     if (keep_annotations == none)
@@ -620,10 +890,21 @@ static bool keep_annotation(const scrambler::node *n, annotation_mode keep_annot
     return n->children.size() == 2 && n->children[1]->symbol == ":pattern";
 }
 
-void print_node(std::ostream &out, const scrambler::node *n, annotation_mode keep_annotations)
+/*
+ * Printing is not a pass (see passes.h), since it could not share a
+ * traversal with any: it needs the results of all of them for the whole
+ * segment, i.e., the order of the commands and the name ids (which
+ * depend on the sorted assertions), and the sizes of the commands, by
+ * which print_commands splits the work between threads.
+ * keep_annotation is decided here, while printing.
+ */
+template <class Out>
+void print_node(Out &out, const scrambler::node *n,
+                annotation_mode keep_annotations, const naming &names,
+                std::vector<std::string> *unknown, uint64_t annotation_id = 0)
 {
     if (n->symbol == "!" && !keep_annotation(n, keep_annotations)) {
-        print_node(out, n->children[0], keep_annotations);
+        print_node(out, n->children[0], keep_annotations, names, unknown);
     } else {
         if (n->needs_parens) {
             out << '(';
@@ -632,30 +913,33 @@ void print_node(std::ostream &out, const scrambler::node *n, annotation_mode kee
             if (no_scramble || !n->is_name) {
                 out << n->symbol;
             } else {
-                uint64_t name_id = get_name_id(n->symbol.c_str());
+                uint64_t name_id =
+                    names.interned ? lookup_name_id(*names.interned, n->symbol)
+                                   : lookup_name_id(*names.ids, n->symbol);
                 if (name_id == 0) {
                     out << n->symbol;
+                    if (names.record_unknown) {
+                        unknown->push_back(n->symbol);
+                    }
+                } else if (names.permutation) {
+                    assert(name_id < names.permutation->size());
+                    out << 'x' << (*names.permutation)[name_id];
                 } else {
-                    assert(name_id < permuted_name_ids.size());
-                    out << make_name(permuted_name_ids[name_id]);
+                    out << 'x' << name_id;
                 }
             }
         }
-        std::string name;
-        if (gen_ucore && n->symbol == "assert") {
-            name = make_annotation_name();
-        }
-        if (!name.empty()) {
+        if (annotation_id) {
             out << " (!";
         }
         for (size_t i = 0; i < n->children.size(); ++i) {
             if (i > 0 || !n->symbol.empty()) {
                 out << ' ';
             }
-            print_node(out, n->children[i], keep_annotations);
+            print_node(out, n->children[i], keep_annotations, names, unknown);
         }
-        if (!name.empty()) {
-            out << " :named " << name << ")";
+        if (annotation_id) {
+            out << " :named smtcomp" << annotation_id << ")";
         }
         if (n->needs_parens) {
             out << ')';
@@ -663,24 +947,456 @@ void print_node(std::ostream &out, const scrambler::node *n, annotation_mode kee
         if (n->symbol == "check-sat") {
             if (gen_ucore) {
                 // insert (get-unsat-core) after each check-sat
-                out << std::endl << "(get-unsat-core)";
+                out << "\n(get-unsat-core)";
             }
             if (gen_mval) {
                 // insert (get-model) after each check-sat
-                out << std::endl << "(get-model)";
+                out << "\n(get-model)";
             }
             if (gen_proof) {
                 // insert (get-proof) after each check-sat
-                out << std::endl << "(get-proof)";
+                out << "\n(get-proof)";
+            }
+        }
+    }
+}
+
+/*
+ * (push N) and (pop N) are stored as one command whose only child is N
+ * (see parser.y), but printed as N copies of (push 1) or (pop 1), since
+ * push N and pop N are not allowed in SMT-COMP.
+ */
+static uint64_t repeat_count(const scrambler::node *cmd)
+{
+    if ((cmd->symbol != "push" && cmd->symbol != "pop") ||
+        cmd->children.size() != 1) {
+        return 1;
+    }
+    return strtoull(cmd->children[0]->symbol.c_str(), NULL, 10);
+}
+
+// the copies are written in blocks of precomputed text
+template <class Out>
+void print_repeated(Out &out, const std::string &symbol, uint64_t count)
+{
+    const uint64_t lines_per_block = 512;
+    std::string line = "(" + symbol + " 1)\n";
+    if (count >= lines_per_block) {
+        std::string block;
+        block.reserve(line.size() * lines_per_block);
+        for (uint64_t i = 0; i < lines_per_block; ++i) {
+            block.append(line);
+        }
+        for (; count >= lines_per_block; count -= lines_per_block) {
+            out << block;
+        }
+    }
+    for (; count > 0; --count) {
+        out << line;
+    }
+}
+
+// the encoder tokenizes C strings (but not std::strings)
+void print_repeated(scrambler::binary_encoder &out, const std::string &symbol,
+                    uint64_t count)
+{
+    std::string line = "(" + symbol + " 1)\n";
+    for (; count > 0; --count) {
+        out << line.c_str();
+    }
+}
+
+template <class Out>
+void print_command(Out &out, const scrambler::node *n,
+                   annotation_mode keep_annotations, const naming &names,
+                   std::vector<std::string> *unknown, uint64_t annotation_id)
+{
+    uint64_t count = repeat_count(n);
+    if (count != 1) {
+        print_repeated(out, n->symbol, count);
+        return;
+    }
+    print_node(out, n, keep_annotations, names, unknown, annotation_id);
+    out << '\n';
+}
+
+// counts the nodes of each command (used as weights for scheduling),
+// and the nesting depth of the deepest command (printing recurses once
+// per level, hence threads that print need a stack that deep)
+class node_count_pass : public scrambler::pass {
+public:
+    explicit node_count_pass(std::vector<uint64_t> *counts)
+        : pass("node_count", scrambler::effect_tree, 0), counts(counts),
+          levels(counts->size(), 0), depths(counts->size(), 0) {}
+
+    bool begin_command(const scrambler::node *, size_t index)
+    {
+        (*counts)[index] = 0;
+        return true;
+    }
+    bool pre(const scrambler::node *, size_t index)
+    {
+        ++(*counts)[index];
+        depths[index] = std::max(depths[index], ++levels[index]);
+        return true;
+    }
+    void post(const scrambler::node *, size_t index)
+    {
+        --levels[index];
+    }
+
+    uint64_t max_depth() const
+    {
+        return depths.empty() ? 0 : *std::max_element(depths.begin(),
+                                                      depths.end());
+    }
+
+private:
+    std::vector<uint64_t> *counts;
+    std::vector<uint32_t> levels;
+    std::vector<uint32_t> depths;
+};
+
+// number of commands (at the start of commands) that have been printed
+// by stream_commands
+size_t num_streamed = 0;
+
+/*
+ * -emit-index: the positions of the commands in the input (before they
+ * are reordered) are recorded before each segment is printed.
+ */
+scrambler::index_writer command_index;
+std::unordered_map<const scrambler::node *, uint64_t> command_positions;
+// the number of commands parsed before the current segment
+uint64_t num_parsed = 0;
+// (read by the -progress sampler)
+std::atomic<uint32_t> num_segments(0);
+
+void record_positions()
+{
+    for (size_t i = 0; i < commands.size(); ++i) {
+        command_positions[commands[i]] = num_parsed + i;
+    }
+}
+
+// the kind and input position of a command
+typedef std::pair<scrambler::index_kind, uint64_t> indexed_command;
+
+void index_command(const indexed_command &c, uint64_t offset, uint64_t length)
+{
+    command_index.add(c.first, num_segments, c.second, offset, length);
+}
+
+// Upper bound on the number of nodes rendered in one batch by
+// print_commands, which bounds the size of the buffered output.
+const uint64_t max_batch_weight = 1 << 22;
+
+// Encodes cmd with binary_out, and writes the encoding to out whenever
+// enough of it is pending (which bounds memory for repeated push/pop).
+void encode_command(std::ostream &out, const scrambler::node *cmd,
+                    annotation_mode keep_annotations, const naming &names,
+                    std::vector<std::string> *unknown, uint64_t annotation_id)
+{
+    uint64_t count = repeat_count(cmd);
+    if (count == 1) {
+        print_command(binary_out, cmd, keep_annotations, names, unknown,
+                      annotation_id);
+    }
+    while (count > 1) {
+        uint64_t lines = std::min(count, max_batch_weight);
+        print_repeated(binary_out, cmd->symbol, lines);
+        count -= lines;
+        if (binary_out.pending() >= max_batch_weight) {
+            binary_out.write(out);
+        }
+    }
+    if (binary_out.pending() >= max_batch_weight) {
+        binary_out.write(out);
+    }
+}
+
+// Prints (and deletes) all commands. With more than one thread,
+// commands are rendered concurrently, in batches, and written in order;
+// node_counts (if not NULL) are the sizes of the commands, and
+// max_depth the nesting depth of the deepest one (see node_count_pass).
+void print_commands(std::ostream &out, annotation_mode keep_annotations,
+                    const naming &names,
+                    const std::vector<uint64_t> *node_counts = NULL,
+                    uint64_t max_depth = 0)
+{
+    double start = scrambler::stats_clock();
+    size_t n = commands.size();
+
+    // With more than one thread, commands are rendered directly into a
+    // memory-mapped output file (see -out), or else in batches.
+    bool parallel = !binary_format && scrambler::get_num_threads() > 1;
+    bool mapped = parallel && n > num_streamed &&
+                  &out == &scrambler::output() && scrambler::output_is_mapped();
+    bool batched = parallel && !mapped && n >= 2;
+
+    // rendering in parallel needs the sizes of the commands (to balance
+    // the work), and every thread that renders (in parallel or not) a
+    // stack as deep as the deepest command: the workers are given one,
+    // and if the calling thread's stack is smaller, rendering happens on
+    // a thread with one (unless that exceeds the memory budget)
+    std::vector<uint64_t> counts;
+    if (!node_counts) {
+        counts.resize(n);
+        node_count_pass count(&counts);
+        scrambler::run_passes(std::vector<scrambler::pass *>(1, &count),
+                              commands.data(), n);
+        node_counts = &counts;
+        max_depth = count.max_depth();
+    }
+    size_t stack = scrambler::stack_for_depth(max_depth);
+    if ((mapped || batched) && stack > scrambler::get_worker_stack_size()) {
+        scrambler::set_worker_stack_size(stack);
+    }
+    size_t own_stack = scrambler::current_stack_size();
+    if (own_stack > 0 && stack > own_stack) {
+        scrambler::check_stack_budget(stack, num_added);
+        scrambler::run_with_stack(stack, [&]() {
+            print_commands(out, keep_annotations, names, node_counts,
+                           max_depth);
+        });
+        return;
+    }
+
+    // annotation ids depend on the order of assertions, so they are
+    // assigned before rendering
+    std::vector<uint64_t> annotation_ids(n, 0);
+    if (gen_ucore) {
+        for (size_t i = 0; i < n; ++i) {
+            if (commands[i]->symbol == "assert") {
+                annotation_ids[i] = next_annotation_id++;
+            }
+        }
+    }
+
+    // commands are deleted as they are printed, hence what the index
+    // needs is recorded beforehand
+    std::vector<indexed_command> indexed;
+    if (command_index.is_open()) {
+        indexed.resize(n);
+        for (size_t i = num_streamed; i < n; ++i) {
+            indexed[i] = indexed_command(scrambler::command_kind(commands[i]->symbol),
+                                         command_positions[commands[i]]);
+        }
+    }
+
+    // the first num_streamed commands have been printed already
+    std::vector<std::string> unknown;
+    if (binary_format) {
+        // the encoder's symbol table is shared by all commands, hence
+        // they are encoded one at a time
+        for (size_t i = num_streamed; i < n; ++i) {
+            encode_command(out, commands[i], keep_annotations, names,
+                           &unknown, annotation_ids[i]);
+            del_node(commands[i]);
+        }
+        binary_out.write(out);
+    } else if (mapped) {
+        // The output is a regular file (see -out): the length of each
+        // command is computed first, so that commands can be rendered
+        // concurrently into their place in the (memory-mapped) file.
+        // (With one thread, sizing costs more than writing a buffer.)
+        size_t m = n - num_streamed;
+        std::vector<uint64_t> offsets(m + 1, 0);
+        std::vector<std::vector<std::string> > unknown_in_command(m);
+        const uint64_t *weights = node_counts ? &(*node_counts)[num_streamed] : NULL;
+        scrambler::parallel_for(m, weights, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                text_length len;
+                print_command(len, commands[num_streamed + i], keep_annotations,
+                              names, &unknown_in_command[i],
+                              annotation_ids[num_streamed + i]);
+                offsets[i + 1] = len.len;
+            }
+        });
+        for (size_t i = 0; i < m; ++i) {
+            offsets[i + 1] += offsets[i];
+        }
+        if (command_index.is_open()) {
+            uint64_t base = scrambler::output_bytes();
+            for (size_t i = 0; i < m; ++i) {
+                index_command(indexed[num_streamed + i], base + offsets[i],
+                              offsets[i + 1] - offsets[i]);
+            }
+        }
+        char *dest = scrambler::reserve_output(offsets[m]);
+        scrambler::parallel_for(m, weights, [&](size_t begin, size_t end) {
+            std::vector<std::string> ignored;
+            for (size_t i = begin; i < end; ++i) {
+                text_writer w(dest + offsets[i]);
+                print_command(w, commands[num_streamed + i], keep_annotations,
+                              names, &ignored, annotation_ids[num_streamed + i]);
+                assert(w.p == dest + offsets[i + 1]);
+                del_node(commands[num_streamed + i]);
+            }
+        });
+        scrambler::commit_output();
+        for (size_t i = 0; i < m; ++i) {
+            unknown.insert(unknown.end(), unknown_in_command[i].begin(),
+                           unknown_in_command[i].end());
+        }
+    } else if (!batched) {
+        // commands are rendered directly into the stream's buffer
+        stream_writer w(out.rdbuf());
+        for (size_t i = num_streamed; i < n; ++i) {
+            uint64_t offset = scrambler::output_bytes();
+            print_command(w, commands[i], keep_annotations, names,
+                          &unknown, annotation_ids[i]);
+            if (command_index.is_open()) {
+                index_command(indexed[i], offset,
+                              scrambler::output_bytes() - offset);
+            }
+            del_node(commands[i]);
+            if ((i + 1) % commands_per_check == 0) {
+                govern();
+            }
+        }
+    } else {
+        const std::vector<uint64_t> &weights = *node_counts;
+        assert(weights.size() == n);
+
+        std::vector<std::string> rendered;
+        std::vector<std::vector<std::string> > unknown_in_batch;
+        for (size_t first = num_streamed; first < n; ) {
+            size_t last = first;
+            uint64_t batch_weight = 0;
+            while (last < n && (last == first ||
+                                batch_weight + weights[last] <= max_batch_weight)) {
+                batch_weight += weights[last];
+                ++last;
+            }
+            rendered.clear();
+            rendered.resize(last - first);
+            unknown_in_batch.clear();
+            unknown_in_batch.resize(last - first);
+            scrambler::parallel_for(last - first, &weights[first],
+                         [&](size_t begin, size_t end) {
+                text_buffer buf;
+                for (size_t i = first + begin; i < first + end; ++i) {
+                    if (repeat_count(commands[i]) != 1) {
+                        // printed when the batch is written, rather
+                        // than buffered
+                        continue;
+                    }
+                    buf.buf.clear();
+                    print_command(buf, commands[i], keep_annotations, names,
+                                  &unknown_in_batch[i - first],
+                                  annotation_ids[i]);
+                    rendered[i - first].swap(buf.buf);
+                    del_node(commands[i]);
+                }
+            });
+            for (size_t i = 0; i < rendered.size(); ++i) {
+                uint64_t offset = scrambler::output_bytes();
+                // repeated push and pop were left for now
+                if (rendered[i].empty()) {
+                    stream_writer w(out.rdbuf());
+                    print_command(w, commands[first + i], keep_annotations,
+                                  names, NULL, 0);
+                    del_node(commands[first + i]);
+                } else {
+                    out.write(rendered[i].data(), rendered[i].size());
+                }
+                if (command_index.is_open()) {
+                    index_command(indexed[first + i], offset,
+                                  scrambler::output_bytes() - offset);
+                }
+                unknown.insert(unknown.end(), unknown_in_batch[i].begin(),
+                               unknown_in_batch[i].end());
             }
+            first = last;
+            govern();
+        }
+    }
+    for (size_t i = 0; i < unknown.size(); ++i) {
+        std::string name = unquote(unknown[i].c_str());
+        names.record_unknown->insert(std::make_pair(name, 0));
+    }
+    out.flush();
+    if (scrambler::pass_stats_enabled()) {
+        scrambler::add_phase_time("print", scrambler::stats_clock() - start, n);
+    }
+    for (size_t i = 0; i < num_streamed; ++i) {
+        del_node(commands[i]);
+    }
+    commands.clear();
+    num_streamed = 0;
+    command_positions.clear();
+    ++num_segments;
+}
+
+/*
+ * Commands at the start of a segment whose position and printed form
+ * do not depend on the rest of the segment (e.g., set-logic, or push
+ * and pop) are printed as soon as they have been parsed, rather than
+ * when the segment is complete.
+ *
+ * Assertions, declarations and definitions may be reordered, and
+ * names are only mapped to uniform names once the segment has been
+ * parsed; hence streaming stops at the first command that is either
+ * of these or mentions a name.
+ *
+ * As with the segments before it, commands that have been streamed stay
+ * printed if the input turns out to be invalid later in the segment:
+ * the output then ends with them, "ERROR: ..." is printed to stderr,
+ * and the exit code is 1.
+ */
+static bool is_final(const scrambler::node *cmd)
+{
+    const std::string &s = cmd->symbol;
+    if (s == "assert" || s.find("declare") != std::string::npos ||
+        s.find("define") != std::string::npos) {
+        return false;
+    }
+    if (no_scramble) {
+        return true;
+    }
+    std::vector<const scrambler::node *> to_visit(1, cmd);
+    while (!to_visit.empty()) {
+        const scrambler::node *n = to_visit.back();
+        to_visit.pop_back();
+        if (n->is_name && !n->symbol.empty()) {
+            return false;
         }
+        to_visit.insert(to_visit.end(), n->children.begin(), n->children.end());
     }
+    return true;
 }
 
-void print_command(std::ostream &out, const scrambler::node *n, annotation_mode keep_annotations)
+void stream_commands(std::ostream &out, annotation_mode keep_annotations)
 {
-    print_node(out, n, keep_annotations);
-    out << std::endl;
+    static bool needs_flush = false;
+    naming names = { &name_ids, NULL, NULL, NULL };
+    stream_writer w(out.rdbuf());
+    while (num_streamed < commands.size() && is_final(commands[num_streamed])) {
+        if (binary_format) {
+            encode_command(out, commands[num_streamed], keep_annotations,
+                           names, NULL, 0);
+        } else {
+            uint64_t offset = scrambler::output_bytes();
+            print_command(w, commands[num_streamed], keep_annotations, names,
+                          NULL, 0);
+            if (command_index.is_open()) {
+                indexed_command c(scrambler::command_kind(commands[num_streamed]->symbol),
+                                  num_parsed + num_streamed);
+                index_command(c, offset, scrambler::output_bytes() - offset);
+            }
+        }
+        ++num_streamed;
+        needs_flush = true;
+    }
+    if (binary_format && binary_out.pending()) {
+        binary_out.write(out);
+    }
+    // flush once the next command has to wait for the end of the segment
+    if (needs_flush && num_streamed < commands.size()) {
+        out.flush();
+        needs_flush = false;
+    }
 }
 
 // ######################################################################################### //
@@ -693,68 +1409,108 @@ uint64_t next_name_id_sorted = 1;
 // map of "names" (variables, functions, etc) to their corresponding name id
 Name_ID_Map name_ids_sorted; 
 
+// the key of the name n in a Name_ID_Map (as unquote, but without its
+// static buffer, so that queries can be numbered concurrently; see
+// -unroll-incremental)
+static std::string sorted_key(const char *n)
+{
+    size_t len = strlen(n);
+    strip_quotes(n, len);
+    return std::string(n, len);
+}
+
 // declaring a new name
-void set_new_name_sorted(const char *n)
+void set_new_name_sorted(Name_ID_Map &ids, uint64_t &next_id, const char *n)
 {
-    n = unquote(n);
+    std::string key = sorted_key(n);
 
-    if (name_ids_sorted.find(n) == name_ids_sorted.end()) {
-        name_ids_sorted[n] = next_name_id_sorted;
-        ++next_name_id_sorted;
+    if (ids.find(key) == ids.end()) {
+        ids[key] = next_id;
+        ++next_id;
     }
 }
 
 // getting a name's corresponding name id
-uint64_t get_name_id_sorted(const char *n)
+uint64_t get_name_id_sorted(Name_ID_Map &ids, const char *n)
 {
-    n = unquote(n);
-
-    return name_ids_sorted[n];  // 0 if n is not currently in name_ids
+    return ids[sorted_key(n)];  // 0 if n is not currently in ids
 }
 
 // used to find nodes where is_name is true and assigns them the next available name id 
-void assign_num(const scrambler::node *n){
-    for (size_t i = 0; i < n->children.size(); i++) {
-        scrambler::node *new_n = n->children[i];
-        if (!new_n->symbol.empty() && new_n -> is_name && new_n ->symbol != "=") {
-            set_new_name_sorted(new_n -> symbol.c_str());
-        }
+class assign_num_pass : public scrambler::pass {
+public:
+    assign_num_pass(Name_ID_Map &ids, uint64_t &next_id)
+        : pass("assign_num", scrambler::effect_tree, scrambler::effect_sorted_ids),
+          ids(ids), next_id(next_id) {}
+
+    bool begin_command(const scrambler::node *cmd, size_t)
+    {
+        return cmd->symbol == "assert";
     }
-    for (size_t i = 0; i < n->children.size(); ++i) {
-        if (i > 0 || !n->symbol.empty()) {
-            assign_num(n->children[i]);
+    bool pre(const scrambler::node *n, size_t)
+    {
+        for (size_t i = 0; i < n->children.size(); i++) {
+            scrambler::node *new_n = n->children[i];
+            if (!new_n->symbol.empty() && new_n -> is_name && new_n ->symbol != "=") {
+                set_new_name_sorted(ids, next_id, new_n -> symbol.c_str());
+            }
         }
+        return true;
+    }
+    bool enter_child(const scrambler::node *n, size_t i, size_t)
+    {
+        return i > 0 || !n->symbol.empty();
     }
-}
+
+private:
+    Name_ID_Map &ids;
+    uint64_t &next_id;
+};
 
 // returns the first occurence of a node where is_name is true, returns 0 if no such node is found
-uint64_t find_var(const scrambler::node *n){
+// (this is not a pass: it reads the ids that assign_num_pass writes, so it cannot share
+// that traversal, and it only follows the path to the first name of a declaration,
+// rather than walking the whole tree)
+uint64_t find_var(const scrambler::node *n, Name_ID_Map &ids){
     for (size_t i = 0; i < n->children.size(); i++) {
         scrambler::node *new_n = n->children[i];
         if (!new_n->symbol.empty() && new_n -> is_name && new_n ->symbol != "=") {
-            return get_name_id_sorted(new_n -> symbol.c_str());
+            return get_name_id_sorted(ids, new_n -> symbol.c_str());
         }
     }
     for (size_t i = 0; i < n->children.size(); ++i) {
         if (i > 0 || !n->symbol.empty()) {
-            return find_var(n->children[i]);
+            return find_var(n->children[i], ids);
         }
     }
     return 0;
 }
 
 // used to sort declarations and definitions based on a name id's first occurence
-void sort_declarations(std::vector<scrambler::node *> *v, size_t start, size_t end){
-    std::vector<std::pair<uint64_t, scrambler::node*>> combined_data;
+// (node_counts, if not NULL, are permuted along with the commands)
+void sort_declarations(std::vector<scrambler::node *> *v, size_t start, size_t end,
+                       Name_ID_Map &ids, std::vector<uint64_t> *node_counts){
+    std::vector<std::pair<std::pair<uint64_t, scrambler::node*>, uint64_t>> combined_data;
     
     for (size_t i = start; i < end; ++i) {
-        combined_data.push_back(std::make_pair(find_var((*v)[i]),(*v)[i]));
-    }
-
-    std::sort(combined_data.begin(), combined_data.end());
+        combined_data.push_back(std::make_pair(std::make_pair(find_var((*v)[i], ids),(*v)[i]),
+                                               node_counts ? (*node_counts)[i] : 0));
+    }
+
+    // ties keep their input order (rather than being broken by node
+    // address, which depends on how memory was allocated, e.g., by
+    // which thread)
+    std::stable_sort(combined_data.begin(), combined_data.end(),
+                     [](const std::pair<std::pair<uint64_t, scrambler::node*>, uint64_t> &a,
+                        const std::pair<std::pair<uint64_t, scrambler::node*>, uint64_t> &b) {
+                         return a.first.first < b.first.first;
+                     });
     
     for(size_t i = 0; i < end-start; i++){
-        commands[i+start] = combined_data[i].second;
+        (*v)[i+start] = combined_data[i].first.second;
+        if (node_counts) {
+            (*node_counts)[i+start] = combined_data[i].second;
+        }
     }
 }
 
@@ -794,94 +1550,39 @@ std::vector<float> get_ranks(int size) {
     return output;
 }
 
-// modified version of print_node
-void print_node_sorted(std::ostream &out, const scrambler::node *n, annotation_mode keep_annotations)
+/*
+ * Orders the commands v of a segment (or of a query, see
+ * -unroll-incremental) for print_ranked: assertions are sorted by their
+ * ranks, names receive ids (in ids, from next_id on) in the order of
+ * their first appearance in the sorted assertions, and declarations and
+ * definitions are sorted by the id of the first name they mention.
+ *
+ * fused (if not NULL) is a pass that runs in the same traversal as the
+ * assignment of ids, e.g., to count the nodes of each command; these
+ * node_counts (if not NULL) are permuted along with the commands.
+ */
+void rank_commands(std::vector<scrambler::node *> &v, Name_ID_Map &ids,
+                   uint64_t &next_id, scrambler::pass *fused,
+                   std::vector<uint64_t> *node_counts)
 {
-    if (n->symbol == "!" && !keep_annotation(n, keep_annotations)) {
-        print_node_sorted(out, n->children[0], keep_annotations);
-    } else {
-        if (n->needs_parens) {
-            out << '(';
-        }
-        if (!n->symbol.empty()) {
-            if (no_scramble || !n->is_name) {
-                out << n->symbol;
-            } else {
-                // uses get_name_id_sorted
-                uint64_t name_id = get_name_id_sorted(n->symbol.c_str());
-                if (name_id == 0) {
-                    out << n->symbol;
-                } else {
-                    out << make_name(name_id);
-                }
-            }
-        }
-        std::string name;
-        if (gen_ucore && n->symbol == "assert") {
-            name = make_annotation_name();
-        }
-        if (!name.empty()) {
-            out << " (!";
-        }
-        for (size_t i = 0; i < n->children.size(); ++i) {
-            if (i > 0 || !n->symbol.empty()) {
-                out << ' ';
-            }
-            print_node_sorted(out, n->children[i], keep_annotations);
-        }
-        if (!name.empty()) {
-            out << " :named " << name << ")";
-        }
-        if (n->needs_parens) {
-            out << ')';
-        }
-        if (n->symbol == "check-sat") {
-            if (gen_ucore) {
-                // insert (get-unsat-core) after each check-sat
-                out << std::endl << "(get-unsat-core)";
-            }
-            if (gen_mval) {
-                // insert (get-model) after each check-sat
-                out << std::endl << "(get-model)";
-            }
-            if (gen_proof) {
-                // insert (get-proof) after each check-sat
-                out << std::endl << "(get-proof)";
-            }
-        }
-    }
-}
-
-// modified version of print_command
-void print_command_sorted(std::ostream &out, const scrambler::node *n, annotation_mode keep_annotations)
-{
-    // uses print_node_sorted
-    print_node_sorted(out, n, keep_annotations);
-    out << std::endl;
-}
-
-
-// modified version of print_scrambled
-void print_ranked(std::ostream &out, annotation_mode keep_annotations)
-{   
     // either run function to get scores or maybe feed it into this function? idk
     std::vector<float> ranks;
 
     // identify consecutive assertions and sort them
     // currently this breaks if assertions are in multiple discrete groups because it's lazily copied from print_scrambled
-    for (size_t i = 0; i < commands.size(); ) {
+    for (size_t i = 0; i < v.size(); ) {
         bool already = false;
-        if (commands[i]->symbol == "assert" && !already) {
+        if (v[i]->symbol == "assert" && !already) {
             already = true;
             size_t j = i+1;
-            while (j < commands.size() && commands[j]->symbol == "assert"){ ++j; }
+            while (j < v.size() && v[j]->symbol == "assert"){ ++j; }
             ranks = get_ranks(j - i);
             if (j - i > 1) {
-                shuffle_list(&commands, i, j, ranks);
+                shuffle_list(&v, i, j, ranks);
             }
             i = j;
         } 
-        else if (commands[i]->symbol == "assert" && already) {
+        else if (v[i]->symbol == "assert" && already) {
             throw std::invalid_argument("assertions in multiple chunks");
         }
         else {
@@ -891,39 +1592,51 @@ void print_ranked(std::ostream &out, annotation_mode keep_annotations)
 
     // assign each variable a number in correspondence to
     // its first appearance in the newly sorted assertions
-    for (size_t i = 0; i < commands.size(); i++){
-        if (commands[i] -> symbol == "assert"){
-            assign_num(commands[i]);
-        }
+    assign_num_pass assign(ids, next_id);
+    std::vector<scrambler::pass *> passes(1, &assign);
+    if (fused) {
+        passes.push_back(fused);
     }
+    scrambler::run_passes(passes, v.data(), v.size());
 
     // sort declarations and definitions    
     // currently this breaks if declarations or definitions are in multiple discrete groups because it's lazily copied from print_scrambled
-    for (size_t i = 0; i < commands.size(); ) {
+    for (size_t i = 0; i < v.size(); ) {
         bool already = false;
-        if (((commands[i] -> symbol).find("declare") != std::string::npos ||(commands[i] -> symbol).find("define") != std::string::npos) && !already) {
+        if (((v[i] -> symbol).find("declare") != std::string::npos ||(v[i] -> symbol).find("define") != std::string::npos) && !already) {
             already = true;
             size_t j = i+1;
-            while (j < commands.size() && ((commands[j] -> symbol).find("declare") != std::string::npos ||(commands[j] -> symbol).find("define") != std::string::npos)){ ++j; }
+            while (j < v.size() && ((v[j] -> symbol).find("declare") != std::string::npos ||(v[j] -> symbol).find("define") != std::string::npos)){ ++j; }
             if (j - i > 1) {
-                sort_declarations(&commands, i, j);
+                sort_declarations(&v, i, j, ids, node_counts);
             }
             i = j;
         } 
-        else if (((commands[i] -> symbol).find("declare") != std::string::npos ||(commands[i] -> symbol).find("define") != std::string::npos) && already) {
+        else if (((v[i] -> symbol).find("declare") != std::string::npos ||(v[i] -> symbol).find("define") != std::string::npos) && already) {
             throw std::invalid_argument("declarations and definitions in multiple chunks");
         }
         else {
             ++i;
         }
     }
+}
 
-    // print all commands using print_commands_sorted
-    for (size_t i = 0; i < commands.size(); ++i) {
-        print_command_sorted(out, commands[i], keep_annotations);
-        del_node(commands[i]);
-    }
-    commands.clear();
+// modified version of print_scrambled
+void print_ranked(std::ostream &out, annotation_mode keep_annotations)
+{   
+    // the sizes of commands, needed to print them in parallel, and the
+    // depth of the deepest one, which the stack of the printing threads
+    // must allow for, are counted in the same traversal that assigns
+    // name ids
+    std::vector<uint64_t> node_counts(commands.size());
+    node_count_pass count(&node_counts);
+    rank_commands(commands, name_ids_sorted, next_name_id_sorted, &count,
+                  &node_counts);
+
+    // print all commands, using the name ids assigned above
+    naming names = { NULL, &name_ids_sorted, NULL, &name_ids_sorted };
+    print_commands(out, keep_annotations, names, &node_counts,
+                   count.max_depth());
 }
 
 // ####################################################################################### //
@@ -969,6 +1682,8 @@ void print_scrambled(std::ostream &out, annotation_mode keep_annotations)
             }
         }
 
+        assign_name_ids();
+
         // Generate a random permutation of name ids. Note that index
         // 0 is unused in the permuted_name_ids vector (but present to
         // simplify indexing), and index next_name_id is out of range.
@@ -989,20 +1704,23 @@ void print_scrambled(std::ostream &out, annotation_mode keep_annotations)
             if (old_size == 0) {
                 old_size = 1;
             }
-            // Knuth shuffle
-            for (size_t i = old_size; i < next_name_id - 1; ++i) {
-                size_t j = i + next_rand_int(next_name_id - i);
-                std::swap(permuted_name_ids[i], permuted_name_ids[j]);
+            if (parallel_shuffle) {
+                scrambler::merge_shuffle(&permuted_name_ids[old_size],
+                                         next_name_id - old_size,
+                                         next_rand_int(SIZE_MAX));
+            } else {
+                // Knuth shuffle
+                for (size_t i = old_size; i < next_name_id - 1; ++i) {
+                    size_t j = i + next_rand_int(next_name_id - i);
+                    std::swap(permuted_name_ids[i], permuted_name_ids[j]);
+                }
             }
         }
     }
 
     // print all commands
-    for (size_t i = 0; i < commands.size(); ++i) {
-        print_command(out, commands[i], keep_annotations);
-        del_node(commands[i]);
-    }
-    commands.clear();
+    naming names = { &name_ids, NULL, &permuted_name_ids, NULL };
+    print_commands(out, keep_annotations, names);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -1057,62 +1775,379 @@ bool parse_core(std::istream &src, StringSet &out)
     return true;
 }
 
-std::string get_named_annot(scrambler::node *root)
-{
-    std::vector<scrambler::node *> to_process;
-    std::unordered_set<scrambler::node *> seen;
-
-    to_process.push_back(root);
-    while (!to_process.empty()) {
-        scrambler::node *cur = to_process.back();
-        to_process.pop_back();
+// Finds the :named annotation of each assertion. If there are several,
+// the right-most one that is not nested in another one is used.
+class named_annot_pass : public scrambler::pass {
+public:
+    explicit named_annot_pass(std::vector<std::string> *names)
+        : pass("named_annot", scrambler::effect_tree, 0), names(names),
+          current(names->size(), NULL) {}
 
-        if (!seen.insert(cur).second) {
-            continue;
-        }
-        if (cur->symbol == "!") {
-            if (cur->children.size() >= 1) {
-                to_process.push_back(cur->children[0]);
-            }
-            if (cur->children.size() >= 2) {
-                for (size_t j = 1; j < cur->children.size(); ++j) {
-                    scrambler::node *attr = cur->children[j];
-                    if (attr->symbol == ":named" &&
-                        !attr->children.empty()) {
-                        return attr->children[0]->symbol;
-                    }
+    bool begin_command(const scrambler::node *cmd, size_t)
+    {
+        return cmd->symbol == "assert";
+    }
+    bool pre(const scrambler::node *n, size_t index)
+    {
+        if (n->symbol == "!" && !current[index]) {
+            for (size_t j = 1; j < n->children.size(); ++j) {
+                scrambler::node *attr = n->children[j];
+                if (attr->symbol == ":named" && !attr->children.empty()) {
+                    (*names)[index] = attr->children[0]->symbol;
+                    current[index] = n;
+                    break;
                 }
             }
-        } else {
-            for (size_t j = 0; j < cur->children.size(); ++j) {
-                to_process.push_back(cur->children[j]);
-            }
+        }
+        return true;
+    }
+    bool enter_child(const scrambler::node *n, size_t i, size_t)
+    {
+        // attributes are not searched
+        return n->symbol != "!" || i == 0;
+    }
+    void post(const scrambler::node *n, size_t index)
+    {
+        if (current[index] == n) {
+            current[index] = NULL;
         }
     }
 
-    return "";
-}
+private:
+    std::vector<std::string> *names;
+    // the annotation found most recently, while it is being visited
+    std::vector<const scrambler::node *> current;
+};
 
 // Used by the post-processor in the unsat core track to filter the
 // assertions and only keep those that appear in the unsat core.
 // The string set `to_keep` lists all names that should be kept.
 void filter_named(const StringSet &to_keep)
 {
+    // the names are extracted concurrently, the commands are then
+    // filtered in order
+    std::vector<std::string> names(commands.size());
+    named_annot_pass find_names(&names);
+    scrambler::run_passes(std::vector<scrambler::pass *>(1, &find_names),
+                          commands.data(), commands.size());
+
     size_t i, k;
     for (i = k = 0; i < commands.size(); ++i) {
-        scrambler::node *cur = commands[i];
-        bool keep = true;
-        if (cur->symbol == "assert") {
-            std::string name = get_named_annot(cur);
-            if (!name.empty() && to_keep.find(name) == to_keep.end()) {
-                keep = false;
+        if (names[i].empty() || to_keep.find(names[i]) != to_keep.end()) {
+            commands[k++] = commands[i];
+        } else {
+            del_node(commands[i]);
+        }
+    }
+    commands.resize(k);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// SMT-LIB commands that are prepended to the output
+std::string prelude(bool single_query)
+{
+    std::string result;
+    if (single_query) {
+        // suppress success for non-incremental tracks
+        result += "(set-option :print-success false)\n";
+    }
+    if (gen_ucore) {
+        // enable production of unsat cores
+        result += "(set-option :produce-unsat-cores true)\n";
+    }
+    if (gen_mval) {
+        // enable production of models
+        result += "(set-option :produce-models true)\n";
+    }
+    if (gen_proof) {
+        // enable production of proofs
+        result += "(set-option :produce-proofs true)\n";
+    }
+    return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+/*
+ * -unroll-incremental
+ *
+ * An incremental benchmark is turned into one single-query benchmark
+ * per check-sat, which contains the commands on the assertion stack at
+ * that check-sat (without push and pop), and only those declarations
+ * that are needed by later commands. Each query is then ordered and
+ * named by rank_commands, so that its file is what the scrambler prints
+ * for the query on its own.
+ *
+ * The assertion stack is a linked list of commands, whose tails are
+ * shared by all queries that contain them; recording a query thus
+ * takes constant time and space. Queries are written in batches, in
+ * parallel (see -threads). A command that is popped is deleted right
+ * away if no pending query contains it, and otherwise once the pending
+ * queries have been written.
+ */
+
+struct stack_entry {
+    scrambler::node *cmd;
+    const stack_entry *prev;
+    size_t depth;      // the number of commands up to and including cmd
+    size_t pushed_at;  // the number of queries recorded before cmd
+};
+
+struct unrolled_query {
+    const stack_entry *top;  // NULL if the stack is empty
+    scrambler::node *check_sat;
+    size_t index;            // the query is written to PREFIX-index.smt2
+};
+
+std::string unroll_prefix;
+
+// the entries of the stack, and those of popped commands that may
+// still be part of pending queries (constructed on first use: a deque
+// allocates, which only unrolling needs to pay for)
+static std::deque<stack_entry> &stack_entries()
+{
+    static std::deque<stack_entry> entries;
+    return entries;
+}
+const stack_entry *stack_top = NULL;
+// stack_top at each (unmatched) push; consecutive pushes (e.g., push N)
+// share one frame
+struct stack_frame {
+    const stack_entry *top;
+    uint64_t pushes;
+};
+std::vector<stack_frame> stack_frames;
+
+std::vector<unrolled_query> pending_queries;
+// popped commands that pending queries contain, which are deleted once
+// those are written
+std::vector<scrambler::node *> popped_commands;
+size_t num_unrolled = 0;
+
+const size_t max_pending_queries = 256;
+
+// adds the (unquoted) names in the tree n to names
+static void collect_names(const scrambler::node *n,
+                          std::unordered_set<std::string> &names)
+{
+    std::vector<const scrambler::node *> to_visit(1, n);
+    while (!to_visit.empty()) {
+        n = to_visit.back();
+        to_visit.pop_back();
+        if (n->is_name && !n->symbol.empty()) {
+            const char *p = n->symbol.data();
+            size_t len = n->symbol.size();
+            strip_quotes(p, len);
+            names.insert(std::string(p, len));
+        }
+        to_visit.insert(to_visit.end(), n->children.begin(), n->children.end());
+    }
+}
+
+// the name declared by cmd, if cmd declares exactly one name
+static const scrambler::node *declared_name(const scrambler::node *cmd)
+{
+    const std::string &s = cmd->symbol;
+    if ((s == "declare-fun" || s == "define-fun" || s == "declare-sort" ||
+         s == "define-sort") && !cmd->children.empty() &&
+        cmd->children[0]->is_name) {
+        return cmd->children[0];
+    }
+    return NULL;
+}
+
+// writes q to its file; returns false on errors
+static bool write_unrolled(const unrolled_query &q,
+                           annotation_mode keep_annotations)
+{
+    // the commands of the query, collected from last to first, so that
+    // declarations of names that are not used later can be dropped
+    std::vector<scrambler::node *> cmds(1, q.check_sat);
+    std::unordered_set<std::string> used;
+    for (const stack_entry *e = q.top; e; e = e->prev) {
+        const scrambler::node *name = declared_name(e->cmd);
+        size_t first = 0;
+        if (name) {
+            const char *p = name->symbol.data();
+            size_t len = name->symbol.size();
+            strip_quotes(p, len);
+            if (used.find(std::string(p, len)) == used.end()) {
+                continue;
+            }
+            first = 1;
+        }
+        for (size_t i = first; i < e->cmd->children.size(); ++i) {
+            collect_names(e->cmd->children[i], used);
+        }
+        cmds.push_back(e->cmd);
+    }
+    std::reverse(cmds.begin(), cmds.end());
+
+    // the query is ordered and named as print_ranked would order and
+    // name it (as a benchmark of its own)
+    Name_ID_Map ids;
+    uint64_t next_id = 1;
+    if (!no_scramble || !ranks_file_name.empty()) {
+        rank_commands(cmds, ids, next_id, NULL, NULL);
+    }
+
+    naming names = { NULL, &ids, NULL, NULL };
+    text_buffer buf;
+    buf << prelude(true);
+    uint64_t annotation_id = 0;
+    for (size_t i = 0; i < cmds.size(); ++i) {
+        bool annotate = gen_ucore && cmds[i]->symbol == "assert";
+        print_command(buf, cmds[i], keep_annotations, names, NULL,
+                      annotate ? ++annotation_id : 0);
+    }
+    buf << "(exit)\n";
+
+    std::ostringstream file_name;
+    file_name << unroll_prefix << '-' << q.index << ".smt2";
+    std::ofstream out(file_name.str().c_str(), std::ios::binary);
+    out.write(buf.buf.data(), buf.buf.size());
+    out.close();
+    return !out.fail();
+}
+
+// Removes the commands above bottom from the stack.
+static void pop_stack(const stack_entry *bottom)
+{
+    while (stack_top != bottom) {
+        const stack_entry *e = stack_top;
+        stack_top = e->prev;
+        // the pending queries are those recorded last; if none of them
+        // was recorded since cmd was pushed, none contains it
+        if (pending_queries.empty() || e->pushed_at == num_unrolled) {
+            del_node(e->cmd);
+            // (entries above e were popped, and hence deleted, before)
+            if (e == &stack_entries().back()) {
+                stack_entries().pop_back();
             }
+        } else {
+            popped_commands.push_back(e->cmd);
         }
-        if (keep) {
-            commands[k++] = cur;
+    }
+}
+
+// Writes all pending queries, then deletes popped commands and their
+// stack entries.
+void write_unrolled_queries(annotation_mode keep_annotations)
+{
+    double start = scrambler::stats_clock();
+    size_t n = pending_queries.size();
+
+    std::vector<uint64_t> weights(n);
+    for (size_t i = 0; i < n; ++i) {
+        weights[i] = 1 + (pending_queries[i].top ? pending_queries[i].top->depth : 0);
+    }
+    std::atomic<bool> ok(true);
+    scrambler::parallel_for(n, weights.data(), [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            if (!write_unrolled(pending_queries[i], keep_annotations)) {
+                ok = false;
+            }
         }
+    });
+    if (!ok) {
+        std::cerr << "ERROR writing " << unroll_prefix << "-*.smt2" << std::endl;
+        exit(1);
     }
-    commands.resize(k);
+
+    for (size_t i = 0; i < n; ++i) {
+        del_node(pending_queries[i].check_sat);
+    }
+    pending_queries.clear();
+    for (size_t i = 0; i < popped_commands.size(); ++i) {
+        del_node(popped_commands[i]);
+    }
+    popped_commands.clear();
+
+    // only the entries on the stack remain (which are renewed, as
+    // popped entries may be interleaved with them)
+    std::vector<const stack_entry *> live(stack_top ? stack_top->depth : 0);
+    for (const stack_entry *e = stack_top; e; e = e->prev) {
+        live[e->depth - 1] = e;
+    }
+    std::deque<stack_entry> entries;
+    for (size_t i = 0; i < live.size(); ++i) {
+        stack_entry e = { live[i]->cmd, i ? &entries.back() : NULL, i + 1,
+                          live[i]->pushed_at };
+        entries.push_back(e);
+    }
+    for (size_t i = 0; i < stack_frames.size(); ++i) {
+        if (stack_frames[i].top) {
+            stack_frames[i].top = &entries[stack_frames[i].top->depth - 1];
+        }
+    }
+    stack_top = entries.empty() ? NULL : &entries.back();
+    stack_entries().swap(entries);
+
+    if (scrambler::pass_stats_enabled()) {
+        scrambler::add_phase_time("unroll", scrambler::stats_clock() - start, n);
+    }
+}
+
+// Moves the parsed commands onto the stack (or records queries).
+void unroll_commands(annotation_mode keep_annotations)
+{
+    for (size_t i = 0; i < commands.size(); ++i) {
+        scrambler::node *cmd = commands[i];
+        const std::string &s = cmd->symbol;
+        if (s == "push") {
+            if (stack_frames.empty() || stack_frames.back().top != stack_top) {
+                stack_frame f = { stack_top, 0 };
+                stack_frames.push_back(f);
+            }
+            stack_frames.back().pushes += repeat_count(cmd);
+            del_node(cmd);
+        } else if (s == "pop") {
+            for (uint64_t pops = repeat_count(cmd); pops > 0; ) {
+                if (stack_frames.empty()) {
+                    std::cerr << "ERROR pop without matching push" << std::endl;
+                    exit(1);
+                }
+                stack_frame &f = stack_frames.back();
+                uint64_t k = std::min(pops, f.pushes);
+                pop_stack(f.top);
+                f.pushes -= k;
+                pops -= k;
+                if (f.pushes == 0) {
+                    stack_frames.pop_back();
+                }
+            }
+            del_node(cmd);
+        } else if (s == "reset") {
+            pop_stack(NULL);
+            stack_frames.clear();
+            del_node(cmd);
+        } else if (s == "check-sat") {
+            unrolled_query q = { stack_top, cmd, ++num_unrolled };
+            pending_queries.push_back(q);
+        } else if (s == "exit" || s.compare(0, 4, "get-") == 0) {
+            // these do not change the assertion stack
+            del_node(cmd);
+        } else {
+            stack_entry e = { cmd, stack_top, stack_top ? stack_top->depth + 1 : 1,
+                              num_unrolled };
+            stack_entries().push_back(e);
+            stack_top = &stack_entries().back();
+        }
+    }
+    commands.clear();
+
+    if (pending_queries.size() >= max_pending_queries) {
+        write_unrolled_queries(keep_annotations);
+    }
+}
+
+// Writes the remaining queries, and deletes the stack.
+void finish_unrolling(annotation_mode keep_annotations)
+{
+    pop_stack(NULL);
+    stack_frames.clear();
+    write_unrolled_queries(keep_annotations);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -1130,6 +2165,120 @@ char *c_strdup(const char *s)
 
 ////////////////////////////////////////////////////////////////////////////////
 
+extern int yyparse();
+
+/*
+ * With -seed 0 (and no -ranks file), commands are neither reordered nor
+ * renamed. Hence each command is printed as soon as it has been parsed,
+ * and deleted right away, so that memory use does not grow with the
+ * size of the benchmark (this is used to normalize benchmarks).
+ */
+void normalize(std::ostream &out, annotation_mode keep_annotations,
+               const StringSet *core_names)
+{
+    double start = scrambler::stats_clock();
+    uint64_t num_printed = 0;
+    naming names = { &name_ids, NULL, NULL, NULL };
+    stream_writer w(out.rdbuf());
+    while (!std::cin.eof()) {
+        yyparse();
+        govern();
+        if (command_index.is_open()) {
+            record_positions();
+        }
+        size_t num_commands = commands.size();
+        if (core_names) {
+            filter_named(*core_names);
+        }
+        for (size_t i = 0; i < commands.size(); ++i) {
+            scrambler::node *cmd = commands[i];
+            uint64_t annotation_id = 0;
+            if (gen_ucore && cmd->symbol == "assert") {
+                annotation_id = next_annotation_id++;
+            }
+            if (binary_format) {
+                encode_command(out, cmd, keep_annotations, names, NULL,
+                               annotation_id);
+            } else {
+                uint64_t offset = scrambler::output_bytes();
+                print_command(w, cmd, keep_annotations, names, NULL,
+                              annotation_id);
+                if (command_index.is_open()) {
+                    indexed_command c(scrambler::command_kind(cmd->symbol),
+                                      command_positions[cmd]);
+                    index_command(c, offset, scrambler::output_bytes() - offset);
+                }
+            }
+            // the solver may wait for the result of each check-sat
+            if (cmd->symbol == "check-sat") {
+                if (binary_format) {
+                    binary_out.write(out);
+                }
+                out.flush();
+                ++num_segments;
+            }
+            del_node(cmd);
+        }
+        num_printed += commands.size();
+        num_parsed += num_commands;
+        commands.clear();
+        command_positions.clear();
+    }
+    if (binary_format) {
+        binary_out.write(out);
+    }
+    out.flush();
+    if (scrambler::pass_stats_enabled()) {
+        scrambler::add_phase_time("normalize", scrambler::stats_clock() - start,
+                                  num_printed);
+    }
+}
+
+/*
+ * Parses the benchmark from stdin, and prints it to out segment by
+ * segment. core_names (if not NULL) are the assertions to keep.
+ */
+void scramble(std::ostream &out, annotation_mode keep_annotations,
+              const StringSet *core_names)
+{
+    if (no_scramble && ranks_file_name.empty()) {
+        normalize(out, keep_annotations, core_names);
+        return;
+    }
+
+    while (!std::cin.eof()) {
+        yyparse();
+        govern();
+        stream_commands(out, keep_annotations);
+        if (!commands.empty() && commands.back()->symbol == "check-sat") {
+            if (command_index.is_open()) {
+                record_positions();
+            }
+            num_parsed += commands.size();
+            if (core_names) {
+                filter_named(*core_names);
+            }
+            assert(!commands.empty());
+            // print_scrambled(out, keep_annotations);
+            print_ranked(out, keep_annotations);
+        }
+    }
+
+    if (command_index.is_open()) {
+        record_positions();
+    }
+    if (core_names) {
+        filter_named(*core_names);
+    }
+    if (!commands.empty()) {
+        // print_scrambled(out, keep_annotations);
+        print_ranked(out, keep_annotations);
+
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
 void usage(const char *program)
 {
     std::cout << "Syntax: " << program << " [OPTIONS] < INPUT_FILE.smt2\n"
@@ -1141,7 +2290,8 @@ void usage(const char *program)
               << "    -seed N\n"
               << "        seed value (>= 0) for pseudo-random choices; if 0, "
                  "no scrambling is\n"
-              << "        performed (default: time(0))\n"
+              << "        performed, and (without -ranks) each command is printed as soon\n"
+              << "        as it has been parsed (default: time(0))\n"
               << "\n"
               << "    -core FILE\n"
               << "        print only those (named) assertions whose name is "
@@ -1182,31 +2332,118 @@ void usage(const char *program)
               << "        controls whether the number of assertions found in the benchmark\n"
               << "        is printed to stderr (default: false)\n\n"
               << "    -ranks <file>\n"
-              << "        specifies a file containing the ranks to be used for sorting\n\n";
+              << "        specifies a file containing the ranks to be used for sorting\n\n"
+              << "    -stats [true|false]\n"
+              << "        controls whether the time spent in each pass, and the time until\n"
+              << "        the first byte of output, is printed to stderr (default: false)\n\n"
+              << "    -format [text|binary]\n"
+              << "        controls whether the benchmark is printed as SMT-LIB text, or in\n"
+              << "        the binary format described in binary.h, which tools/decode_binary\n"
+              << "        converts back to text (default: text)\n\n"
+              << "    -out FILE\n"
+              << "        write the scrambled benchmark to FILE instead of stdout; if FILE\n"
+              << "        is a regular file and N > 1 (see -threads), commands are rendered\n"
+              << "        directly into it (default: stdout)\n\n"
+              << "    -emit-index FILE\n"
+              << "        write the kind, segment, input position, and output offset and\n"
+              << "        length of each printed command to FILE, in the binary format\n"
+              << "        described in index.h (text output without -chunk-size only)\n\n"
+              << "    -shuffle [fisher-yates|merge]\n"
+              << "        algorithm for the random permutations of let bindings and datatype\n"
+              << "        constructors (assertions, declarations and names are ordered by\n"
+              << "        -ranks instead); merge (MergeShuffle) uses all threads (see\n"
+              << "        -threads), and yields a different permutation than fisher-yates,\n"
+              << "        which however does not depend on N either (default: fisher-yates)\n\n"
+              << "    -engine [default|auto]\n"
+              << "        with auto, a scan of the input (if it is a regular file) chooses\n"
+              << "        the number of threads, unless -threads is given, and enlarges the\n"
+              << "        stack for deeply nested terms; the choice is printed by -stats\n"
+              << "        (default: default)\n\n"
+              << "    -chunk-size N\n"
+              << "        pull the output from the scrambler in chunks of at most N bytes,\n"
+              << "        through the interface in generator.h that embedding applications\n"
+              << "        use; the output does not depend on N (default: write directly)\n\n"
+              << "    -unroll-incremental PREFIX\n"
+              << "        instead of printing the benchmark, write one scrambled single-query\n"
+              << "        benchmark per check-sat command, containing the assertion stack at\n"
+              << "        that command, to PREFIX-1.smt2, PREFIX-2.smt2, ... (not with\n"
+              << "        -format binary, -out or -chunk-size)\n\n"
+              << "    -max-memory MB\n"
+              << "        memory budget in megabytes (0: none); near the budget, printing\n"
+              << "        falls back to one thread, and beyond it the run ends with exit\n"
+              << "        code 3 and a one-line JSON reason on stderr (default: 90% of the\n"
+              << "        cgroup's memory limit, if any)\n\n"
+              << "    -max-time SECONDS\n"
+              << "        time budget (0: none); beyond it the run ends with exit code 4\n"
+              << "        and a one-line JSON reason on stderr (default: 0)\n\n"
+              << "    -progress FD\n"
+              << "        write a line of JSON with the input bytes read, the commands\n"
+              << "        parsed, the current segment, the output bytes written, the input\n"
+              << "        MB/s and the resident memory to file descriptor FD every second,\n"
+              << "        see progress.h (default: none)\n\n"
+              << "    -threads N\n"
+              << "        number of threads (>= 1) used for per-command passes, such as\n"
+              << "        printing; the output does not depend on N (default: 1)\n\n"
+              << "Commands are printed as soon as their position in the output is final\n"
+              << "(at the latest, at the end of their segment). If the input has a syntax\n"
+              << "error, the commands printed before it remain in the output, an error\n"
+              << "message starting with \"ERROR: \" is printed to stderr, and the exit\n"
+              << "code is 1.\n";
     std::cout.flush();
     exit(1);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
-extern int yyparse();
-
 using namespace scrambler;
 
+// parses the option value s, a decimal number in [min, max] (without a
+// string stream, whose construction is costly for short runs)
+static bool parse_number(const char *s, uint64_t min, uint64_t max,
+                         uint64_t &x)
+{
+    if (!isdigit((unsigned char)*s)) {
+        return false;
+    }
+    char *end;
+    errno = 0;
+    unsigned long long v = strtoull(s, &end, 10);
+    if (errno == ERANGE || *end != '\0' || v < min || v > max) {
+        return false;
+    }
+    x = v;
+    return true;
+}
+
 int main(int argc, char **argv)
 {
+    double start_time = stats_clock();
+
     annotation_mode keep_annotations = all;
 
     bool create_core = false;
     std::string core_file;
 
+    size_t chunk_size = 0;
+
+    // opened once the options have been checked (it is truncated)
+    const char *out_file = NULL;
+
+    bool auto_engine = false;
+    bool threads_given = false;
+
+    uint64_t max_memory = 0;
+    uint64_t max_time = 0;
+    bool memory_given = false;
+
+    int progress_fd = -1;
+
     set_seed(time(0));
 
     for (int i = 1; i < argc; ) {
         if (strcmp(argv[i], "-seed") == 0 && i+1 < argc) {
-            std::istringstream s(argv[i+1]);
-            int x;
-            if (s >> x && x >= 0) {
+            uint64_t x;
+            if (parse_number(argv[i+1], 0, INT_MAX, x)) {
                 if (x > 0) {
                     set_seed(x);
                 } else {
@@ -1303,6 +2540,99 @@ int main(int argc, char **argv)
                 usage(argv[0]);
             }
             i += 2;
+        } else if (strcmp(argv[i], "-stats") == 0 && i + 1 < argc) {
+            if (strcmp(argv[i + 1], "true") == 0) {
+                set_pass_stats(true);
+            } else if (strcmp(argv[i + 1], "false") == 0) {
+                set_pass_stats(false);
+            } else {
+                usage(argv[0]);
+            }
+            i += 2;
+        } else if (strcmp(argv[i], "-threads") == 0 && i + 1 < argc) {
+            uint64_t x;
+            if (parse_number(argv[i+1], 1, INT_MAX, x)) {
+                scrambler::set_num_threads(x);
+                threads_given = true;
+            } else {
+                std::cerr << "Invalid value for -threads: " << argv[i+1] << std::endl;
+                return 1;
+            }
+            i += 2;
+        } else if (strcmp(argv[i], "-format") == 0 && i + 1 < argc) {
+            if (strcmp(argv[i + 1], "text") == 0) {
+                binary_format = false;
+            } else if (strcmp(argv[i + 1], "binary") == 0) {
+                binary_format = true;
+            } else {
+                usage(argv[0]);
+            }
+            i += 2;
+        } else if (strcmp(argv[i], "-shuffle") == 0 && i + 1 < argc) {
+            if (strcmp(argv[i + 1], "fisher-yates") == 0) {
+                parallel_shuffle = false;
+            } else if (strcmp(argv[i + 1], "merge") == 0) {
+                parallel_shuffle = true;
+            } else {
+                usage(argv[0]);
+            }
+            i += 2;
+        } else if (strcmp(argv[i], "-engine") == 0 && i + 1 < argc) {
+            if (strcmp(argv[i + 1], "default") == 0) {
+                auto_engine = false;
+            } else if (strcmp(argv[i + 1], "auto") == 0) {
+                auto_engine = true;
+            } else {
+                usage(argv[0]);
+            }
+            i += 2;
+        } else if (strcmp(argv[i], "-chunk-size") == 0 && i + 1 < argc) {
+            uint64_t x;
+            if (!parse_number(argv[i+1], 1, SIZE_MAX, x)) {
+                std::cerr << "Invalid value for -chunk-size: " << argv[i+1] << std::endl;
+                return 1;
+            }
+            chunk_size = x;
+            i += 2;
+        } else if (strcmp(argv[i], "-max-memory") == 0 && i + 1 < argc) {
+            if (!parse_number(argv[i+1], 0, UINT64_MAX >> 20, max_memory)) {
+                std::cerr << "Invalid value for -max-memory: " << argv[i+1] << std::endl;
+                return 1;
+            }
+            max_memory <<= 20;
+            memory_given = true;
+            i += 2;
+        } else if (strcmp(argv[i], "-max-time") == 0 && i + 1 < argc) {
+            if (!parse_number(argv[i+1], 0, UINT64_MAX, max_time)) {
+                std::cerr << "Invalid value for -max-time: " << argv[i+1] << std::endl;
+                return 1;
+            }
+            i += 2;
+        } else if (strcmp(argv[i], "-progress") == 0 && i + 1 < argc) {
+            uint64_t x;
+            if (!parse_number(argv[i+1], 0, INT_MAX, x) ||
+                fcntl(x, F_GETFD) < 0) {
+                std::cerr << "Invalid value for -progress: " << argv[i+1] << std::endl;
+                return 1;
+            }
+            progress_fd = x;
+            i += 2;
+        } else if (strcmp(argv[i], "-emit-index") == 0 && i + 1 < argc) {
+            if (!command_index.create(argv[i+1])) {
+                std::cerr << "ERROR opening index file " << argv[i+1] << std::endl;
+                return 1;
+            }
+            i += 2;
+        } else if (strcmp(argv[i], "-out") == 0 && i + 1 < argc) {
+            out_file = argv[i+1];
+            i += 2;
+        } else if (strcmp(argv[i], "-unroll-incremental") == 0 && i + 1 < argc) {
+            unroll_prefix = argv[i+1];
+            if (unroll_prefix.empty()) {
+                std::cerr << "Invalid value for -unroll-incremental: " << argv[i+1] << std::endl;
+                return 1;
+            }
+            i += 2;
         } else if (strcmp(argv[i], "-ranks") == 0 && i + 1 < argc) {
             ranks_file_name = argv[i+1];
             std::cerr << "Ranks file: " << ranks_file_name << std::endl;
@@ -1315,6 +2645,36 @@ int main(int argc, char **argv)
         }
     }
 
+    if (command_index.is_open() &&
+        (binary_format || !unroll_prefix.empty() || chunk_size > 0)) {
+        std::cerr << "ERROR -emit-index requires text output to stdout or -out"
+                  << std::endl;
+        return 1;
+    }
+
+    // the queries are written to files of their own, as text
+    if (!unroll_prefix.empty() && (binary_format || out_file || chunk_size > 0)) {
+        std::cerr << "ERROR -unroll-incremental cannot be combined with "
+                     "-format binary, -out or -chunk-size" << std::endl;
+        return 1;
+    }
+
+    if (out_file && !set_output_file(out_file)) {
+        std::cerr << "ERROR opening output file " << out_file << std::endl;
+        return 1;
+    }
+
+    set_budgets(max_memory, max_time, start_time);
+    // without -max-memory, the run ends (with a reason) before the
+    // cgroup's limit would have it killed
+    if (!memory_given) {
+        use_cgroup_memory_budget();
+    }
+
+    if (progress_fd >= 0) {
+        start_progress(progress_fd, &num_added, &num_segments);
+    }
+
     StringSet core_names;
     if (create_core) {
         std::ifstream src(core_file.c_str());
@@ -1324,25 +2684,16 @@ int main(int argc, char **argv)
         }
     }
 
-    if (!gen_incremental && !count_asrts) {
-        // prepend SMT-LIB command that suppresses success for non-incremental
-        // tracks
-        std::cout << "(set-option :print-success false)" << std::endl;
-    }
-
-    if (gen_ucore) {
-        // prepend SMT-LIB command that enables production of unsat cores
-        std::cout << "(set-option :produce-unsat-cores true)" << std::endl;
-    }
-
-    if (gen_mval) {
-        // prepend SMT-LIB command that enables production of models
-        std::cout << "(set-option :produce-models true)" << std::endl;
-    }
-
-    if (gen_proof) {
-        // prepend SMT-LIB command that enables production of models
-        std::cout << "(set-option :produce-proofs true)" << std::endl;
+    if (unroll_prefix.empty()) {
+        std::string text = prelude(!gen_incremental && !count_asrts);
+        if (binary_format) {
+            write_binary_header(output());
+            binary_out << text.c_str();
+            binary_out.write(output());
+        } else {
+            output() << text;
+        }
+        output().flush();
     }
 
     if (count_asrts) {
@@ -1356,28 +2707,99 @@ int main(int argc, char **argv)
             }
         }
         std::cerr << "; Number of assertions: " << asrt_count << "\n";
+        stop_progress();
         exit(0);
     }
 
-    while (!std::cin.eof()) {
-        yyparse();
-        if (!commands.empty() && commands.back()->symbol == "check-sat") {
+    if (!unroll_prefix.empty()) {
+        while (!std::cin.eof()) {
+            yyparse();
+            govern();
             if (create_core) {
                 filter_named(core_names);
             }
-            assert(!commands.empty());
-            // print_scrambled(std::cout, keep_annotations);
-            print_ranked(std::cout, keep_annotations);
+            unroll_commands(keep_annotations);
+        }
+        finish_unrolling(keep_annotations);
+        stop_progress();
+        if (pass_stats_enabled()) {
+            print_pass_stats(std::cerr);
         }
+        return 0;
     }
 
-    if (create_core) {
-        filter_named(core_names);
+    // -engine auto: a scan of the input chooses the number of threads
+    // and the stack size (before anything has been parsed)
+    input_profile profile = { false, 0, 0, 0, 0 };
+    engine_choice engine = { get_num_threads(), 0, "" };
+    if (auto_engine) {
+        double scan_start = stats_clock();
+        profile = scan_input(STDIN_FILENO);
+        engine = choose_engine(profile,
+                               memory_budget() ? memory_budget() : physical_memory(),
+                               std::thread::hardware_concurrency());
+        if (threads_given) {
+            engine.threads = get_num_threads();
+            engine.reason += ", -threads given";
+        } else {
+            set_num_threads(engine.threads);
+        }
+        // the workers print terms as deep as the thread they help does
+        if (engine.stack_size > get_worker_stack_size()) {
+            set_worker_stack_size(engine.stack_size);
+        }
+        if (pass_stats_enabled()) {
+            add_phase_time("preflight", stats_clock() - scan_start, 0);
+        }
     }
-    if (!commands.empty()) {
-        // print_scrambled(std::cout, keep_annotations);
-        print_ranked(std::cout, keep_annotations);
 
+    run_with_stack(engine.stack_size, [&]() {
+        if (chunk_size == 0) {
+            scramble(output(), keep_annotations, create_core ? &core_names : NULL);
+        } else {
+            // the producer parses and prints, hence it gets the stack
+            // of this thread (which -engine auto may have enlarged)
+            chunk_generator chunks([&](std::ostream &out) {
+                scramble(out, keep_annotations, create_core ? &core_names : NULL);
+            }, chunk_size, current_stack_size());
+            std::string chunk;
+            while (chunks.next(chunk)) {
+                output().write(chunk.data(), chunk.size());
+            }
+            output().flush();
+        }
+    });
+
+    if (!command_index.close()) {
+        std::cerr << "ERROR writing index file" << std::endl;
+        return 1;
+    }
+    stop_progress();
+
+    if (pass_stats_enabled()) {
+        if (auto_engine && profile.scanned) {
+            std::cerr << "[stats] preflight: " << profile.bytes << " bytes, "
+                      << profile.commands << " commands, " << profile.segments
+                      << " segments, depth " << profile.max_depth << std::endl;
+        }
+        if (auto_engine) {
+            std::cerr << "[stats] engine: " << engine.threads << " threads, "
+                      << (engine.stack_size ? "enlarged" : "default") << " stack ("
+                      << engine.reason << ")" << std::endl;
+        }
+        if (memory_budget() || max_time) {
+            std::cerr << "[stats] governor: memory budget " << (memory_budget() >> 20)
+                      << " MB, time budget " << max_time << " s";
+            if (degraded_at) {
+                std::cerr << ", one thread from command " << degraded_at;
+            }
+            std::cerr << std::endl;
+        }
+        print_pass_stats(std::cerr);
+        if (first_output_time() > 0) {
+            std::cerr << "[stats] time to first byte: "
+                      << first_output_time() - start_time << " s" << std::endl;
+        }
     }
 
     return 0;
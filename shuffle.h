@@ -0,0 +1,193 @@
+/* -*- C++ -*-
+ *
+ * Parallel random permutations (MergeShuffle)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#ifndef SHUFFLE_H_INCLUDED
+#define SHUFFLE_H_INCLUDED
+
+#include "scheduler.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+
+namespace scrambler {
+
+/*
+ * MergeShuffle (Bacher, Bodini, Hollender and Lumbroso, 2015): the
+ * array is split into blocks of a fixed size, which are shuffled
+ * (Fisher-Yates) concurrently; then adjacent shuffled runs are merged,
+ * pairwise and concurrently, into runs of twice the size, until one
+ * run is left. Each merge flips a coin per element to choose the run
+ * that the next element is taken from, and inserts the elements that
+ * remain once one run is exhausted at random positions. The result is
+ * a uniformly random permutation.
+ *
+ * All random choices of a block (or merge) come from a generator seeded
+ * with the seed and the block's position, and the blocks depend only
+ * on the size of the array. Hence the permutation depends on the seed,
+ * but not on the number of threads (see -threads).
+ *
+ * Memory is accessed sequentially, except within a block (which fits
+ * into the cache) and by the final insertions of each merge (whose
+ * expected number is only about the square root of the run size).
+ * Merges copy their first run, i.e., need up to n/2 elements of extra
+ * memory.
+ */
+
+// random number generator for the shuffles (SplitMix64)
+class shuffle_rng {
+public:
+    explicit shuffle_rng(uint64_t seed) : state(seed), bits(0), num_bits(0) {}
+
+    uint64_t next() {
+        uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+
+    // uniformly random in [0, bound), for bound > 0 (Lemire's method,
+    // without modulo bias)
+    uint64_t below(uint64_t bound) {
+        unsigned __int128 m = (unsigned __int128)next() * bound;
+        uint64_t low = (uint64_t)m;
+        if (low < bound) {
+            uint64_t threshold = -bound % bound;
+            while (low < threshold) {
+                m = (unsigned __int128)next() * bound;
+                low = (uint64_t)m;
+            }
+        }
+        return (uint64_t)(m >> 64);
+    }
+
+    bool coin() {
+        if (num_bits == 0) {
+            bits = next();
+            num_bits = 64;
+        }
+        bool b = bits & 1;
+        bits >>= 1;
+        --num_bits;
+        return b;
+    }
+
+private:
+    uint64_t state;
+    uint64_t bits;
+    unsigned num_bits;
+};
+
+// the seed for the generator of the index-th block (or merge) of the
+// given level (0 for the blocks, 1 for the first merges, ...)
+uint64_t shuffle_stream_seed(uint64_t seed, uint64_t level, uint64_t index);
+
+// the number of elements in a block, unless set otherwise (for testing)
+const size_t default_shuffle_block = 1 << 16;
+
+template <class T>
+void fisher_yates(T *a, size_t n, shuffle_rng &rng)
+{
+    for (size_t i = n; i > 1; --i) {
+        std::swap(a[i - 1], a[rng.below(i)]);
+    }
+}
+
+// a[0, mid) and a[mid, n) are uniformly shuffled; merges them into a
+// uniformly shuffled a[0, n), using buf for a copy of the first run
+template <class T>
+void merge_shuffled(T *a, size_t mid, size_t n, shuffle_rng &rng,
+                    std::vector<T> &buf)
+{
+    buf.assign(a, a + mid);
+    const T *first = buf.data();
+    // Per coin, heads takes the next element of the second run, tails
+    // that of the first. The output (at k) never overtakes the second
+    // run (at j), which is thus merged in place. While neither run is
+    // exhausted, this is done without branches.
+    size_t i = 0;
+    size_t j = mid;
+    size_t k = 0;
+    while (i < mid && j < n) {
+        // neither run can be exhausted within the next steps coins
+        size_t steps = std::min<size_t>(64, std::min(mid - i, n - j));
+        uint64_t coins = rng.next();
+        for (size_t s = 0; s < steps; ++s) {
+            size_t heads = coins & 1;
+            coins >>= 1;
+            // (indexing, rather than ?:, which compilers turn into an
+            // unpredictable branch)
+            T next[2] = { first[i], a[j] };
+            a[k++] = next[heads];
+            j += heads;
+            i += 1 - heads;
+        }
+    }
+    // the coins are flipped until the exhausted run would be chosen
+    if (i == mid) {
+        while (k < n && rng.coin()) {
+            ++k;
+        }
+    } else {
+        std::copy(first + i, first + mid, a + k);
+        while (k < n && !rng.coin()) {
+            ++k;
+        }
+    }
+    // the remaining elements are inserted at random positions
+    for (; k < n; ++k) {
+        std::swap(a[k], a[rng.below(k + 1)]);
+    }
+}
+
+template <class T>
+void merge_shuffle(T *a, size_t n, uint64_t seed,
+                   size_t block = default_shuffle_block)
+{
+    size_t num_blocks = (n + block - 1) / block;
+    parallel_for(num_blocks, NULL, [&](size_t begin, size_t end) {
+        for (size_t k = begin; k < end; ++k) {
+            shuffle_rng rng(shuffle_stream_seed(seed, 0, k));
+            fisher_yates(a + k * block, std::min(block, n - k * block), rng);
+        }
+    });
+    uint64_t level = 1;
+    for (size_t width = block; width < n; width *= 2, ++level) {
+        size_t num_merges = (n + 2 * width - 1) / (2 * width);
+        parallel_for(num_merges, NULL, [&](size_t begin, size_t end) {
+            std::vector<T> buf;
+            for (size_t k = begin; k < end; ++k) {
+                size_t start = k * 2 * width;
+                size_t mid = std::min(start + width, n);
+                size_t stop = std::min(start + 2 * width, n);
+                if (mid < stop) {
+                    shuffle_rng rng(shuffle_stream_seed(seed, level, k));
+                    merge_shuffled(a + start, mid - start, stop - start, rng, buf);
+                }
+            }
+        });
+    }
+}
+
+} // namespace scrambler
+
+#endif // SHUFFLE_H_INCLUDED
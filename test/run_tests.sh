@@ -38,6 +38,462 @@ runtest()
 	done
 }
 
+# prints a benchmark with an assertion nested $1 levels deep, followed by
+# $2 (default: 0) shallow assertions, so that the deep one shares the
+# segment with others
+deep_input()
+{
+	echo "(set-logic QF_UF) (declare-fun p () Bool)"
+	printf '(assert '; printf '(not %.0s' $(seq $1)
+	printf 'p'; printf ')%.0s' $(seq $(($1 + 1))); echo
+	seq ${2:-0} | sed 's/.*/(assert (or p (not p)))/'
+	echo "(check-sat)"
+}
+
+# the output must not depend on the number of threads (-threads), also
+# with a deeply nested term, which needs a deep stack on every thread
+threads()
+{
+  echo "... with seed $2"
+	for test in $1/*.smt2; do
+		echo ${test}
+		result=$(diff <(${SCRAMBLER} -seed $2 -threads 1 < ${test} 2>/dev/null) \
+		              <(${SCRAMBLER} -seed $2 -threads 4 < ${test} 2>/dev/null))
+		if [ ! -z "$result" ]
+    then
+			echo -e "${RED}error:${NOCOLOR} Difference between output with 1 and 4 threads:"
+			echo $result
+			exitcode=1
+		fi
+	done
+	echo "... with a term nested 60000 levels deep"
+	deep=$(mktemp)
+	deep_input 60000 1000 > ${deep}
+	${SCRAMBLER} -seed $2 -threads 4 < ${deep} > ${deep}.out 2>/dev/null
+	status=$?
+	if [ $status -ne 0 ] ||
+	   ! cmp -s <(${SCRAMBLER} -seed $2 -threads 1 < ${deep} 2>/dev/null) ${deep}.out
+	then
+		echo -e "${RED}error:${NOCOLOR} Output with 4 threads (exit code $status) differs from 1 thread"
+		exitcode=1
+	fi
+	rm -f ${deep} ${deep}.out
+}
+
+# the engine chosen by -engine auto must not change the output, and
+# must give every thread the stack that deeply nested terms need
+engine()
+{
+  echo "... with seed $2"
+	for test in $1/*.smt2; do
+		echo ${test}
+		result=$(diff <(${SCRAMBLER} -seed $2 < ${test} 2>/dev/null) \
+		              <(${SCRAMBLER} -seed $2 -engine auto < ${test} 2>/dev/null))
+		if [ ! -z "$result" ]
+    then
+			echo -e "${RED}error:${NOCOLOR} Difference between output with and without -engine auto:"
+			echo $result
+			exitcode=1
+		fi
+	done
+	echo "... with a term nested 100000 levels deep"
+	deep=$(mktemp)
+	deep_input 100000 1000 > ${deep}
+	${SCRAMBLER} -seed $2 -engine auto -threads 4 < ${deep} > ${deep}.out 2>/dev/null
+	status=$?
+	if [ $status -ne 0 ] ||
+	   ! cmp -s <(${SCRAMBLER} -seed $2 -engine auto < ${deep} 2>/dev/null) ${deep}.out
+	then
+		echo -e "${RED}error:${NOCOLOR} Output with -engine auto and 4 threads (exit code $status) differs from 1 thread"
+		exitcode=1
+	fi
+	rm -f ${deep} ${deep}.out
+}
+
+# statistics (-stats) go to stderr and must not change the output, and
+# neither may the number of threads that run the fused passes (e.g.,
+# the extraction of :named assertions for -core)
+stats()
+{
+  echo "... with seed $2"
+	core=$(mktemp)
+	printf 'unsat\n(smtcomp1 smtcomp3)\n' > ${core}
+	for test in $1/*.smt2; do
+		echo ${test}
+		result=$(diff <(${SCRAMBLER} -seed $2 < ${test} 2>/dev/null) \
+		              <(${SCRAMBLER} -seed $2 -stats true < ${test} 2>/dev/null)
+		         diff <(${SCRAMBLER} -seed $2 -core ${core} < ${test} 2>/dev/null) \
+		              <(${SCRAMBLER} -seed $2 -core ${core} -stats true -threads 4 < ${test} 2>/dev/null))
+		stats=$(${SCRAMBLER} -seed $2 -stats true < ${test} 2>&1 >/dev/null)
+		if [ ! -z "$result" ] || [[ "$stats" != *'[stats] pass print:'* ]]
+    then
+			echo -e "${RED}error:${NOCOLOR} Output changed by -stats or -threads, or no statistics:"
+			echo $result $stats
+			exitcode=1
+		fi
+	done
+	rm -f ${core}
+}
+
+# -out FILE must write what would go to stdout, also when commands are
+# rendered concurrently into the (memory-mapped) file
+outfile()
+{
+  echo "... with seed $2"
+	out=$(mktemp)
+	for test in $1/*.smt2; do
+		echo ${test}
+		result=""
+		for threads in 1 4; do
+			${SCRAMBLER} -seed $2 -threads ${threads} -out ${out} < ${test} 2>/dev/null
+			result+=$(diff <(${SCRAMBLER} -seed $2 < ${test} 2>/dev/null) ${out})
+		done
+		if [ ! -z "$result" ]
+    then
+			echo -e "${RED}error:${NOCOLOR} Difference between stdout and -out FILE:"
+			echo $result
+			exitcode=1
+		fi
+	done
+	rm -f ${out}
+}
+
+# prints what is wrong with the index $2 (see index.h) of the output $1
+check_index()
+{
+	local output=$(cat $1; echo x)
+	output=${output%x}
+	[ "$(head -c 4 $2)" == "SMTI" ] || echo "bad magic"
+	[ "$(od -An -t u4 -j 4 -N 4 $2 | tr -d ' ')" == "1" ] || echo "bad version"
+	local end="" segment=0 word position offset length kind prefix
+	while read word position offset length; do
+		kind=$((word & 0xffffffff))
+		[ -z "$end" ] || [ $offset -eq $end ] || echo "gap before offset $offset"
+		end=$((offset + length))
+		[ $((word >> 32)) -eq $segment ] || echo "wrong segment at offset $offset"
+		case $kind in
+			1) prefix="(assert" ;;
+			2) prefix="(check-sat"; segment=$((segment + 1)) ;;
+			3) prefix="(declare-" ;;
+			4) prefix="(define-" ;;
+			5) prefix="(push" ;;
+			6) prefix="(pop" ;;
+			7) prefix="(set-logic" ;;
+			*) prefix="(" ;;
+		esac
+		[[ "${output:offset:length}" == "$prefix"*$'\n' ]] ||
+			echo "no command of kind $kind at offset $offset"
+	done < <(od -An -v -t u8 -j 8 -w32 $2)
+	[ "$end" == "${#output}" ] || echo "the entries end at $end, not at the end of the output"
+}
+
+# the index (-emit-index) must delimit every printed command in the
+# output, with its kind and segment, also when commands are rendered
+# concurrently (see -out)
+emit_index()
+{
+  echo "... with seed $2"
+	out=$(mktemp)
+	idx=$(mktemp)
+	for test in $1/*.smt2; do
+		echo ${test}
+		${SCRAMBLER} -seed $2 -emit-index ${idx} < ${test} > ${out} 2>/dev/null
+		result=$(LC_ALL=C check_index ${out} ${idx})
+		${SCRAMBLER} -seed $2 -threads 4 -out ${out} -emit-index ${idx} < ${test} 2>/dev/null
+		result+=$(LC_ALL=C check_index ${out} ${idx})
+		if [ ! -z "$result" ]
+    then
+			echo -e "${RED}error:${NOCOLOR} Index does not match the output:"
+			echo $result
+			exitcode=1
+		fi
+	done
+	rm -f ${out} ${idx}
+}
+
+# (push N) and (pop N) are kept as one command each, but printed as N
+# lines (push 1) or (pop 1), in any output mode; counts that do not fit
+# into 64 bits are rejected
+pushpop()
+{
+  echo "... with seed $1"
+	input=$(mktemp)
+	printf '(set-logic QF_UF)\n(push 3)\n(declare-fun x () Bool)\n(assert x)\n(push 0)\n(pop 2)\n(check-sat)\n(push 100000)\n(pop 100001)\n' > ${input}
+	expected=$({ yes '(push 1)' | head -n 3; yes '(pop 1)' | head -n 2; echo '(check-sat)'
+	             yes '(push 1)' | head -n 100000; yes '(pop 1)' | head -n 100001; })
+	result=$(diff <(echo "$expected") \
+	              <(${SCRAMBLER} -seed $1 < ${input} 2>/dev/null | grep -E '^\((push|pop|check-sat)')
+	         diff <(echo "$expected") \
+	              <(${SCRAMBLER} -seed $1 -threads 4 < ${input} 2>/dev/null | grep -E '^\((push|pop|check-sat)')
+	         diff <(echo "$expected") \
+	              <(${SCRAMBLER} -seed $1 -format binary < ${input} 2>/dev/null | ${DECODER} | grep -E '^\((push|pop|check-sat)'))
+	if [ ! -z "$result" ]
+	then
+		echo -e "${RED}error:${NOCOLOR} push and pop not printed as (push 1) and (pop 1) lines"
+		exitcode=1
+	fi
+	message=$(printf '(set-logic QF_UF)\n(push 18446744073709551616)\n(check-sat)\n' |
+	          ${SCRAMBLER} -seed $1 2>&1)
+	status=$?
+	if [ $status -ne 1 ] || [[ "$message" != *'push count out of range'* ]]
+	then
+		echo -e "${RED}error:${NOCOLOR} Expected a push count past 64 bits to be rejected, got $status"
+		exitcode=1
+	fi
+	rm -f ${input}
+}
+
+# with -seed 0, commands are printed as they are parsed, in input order
+# and without renaming (declarations are not sorted by first use), so
+# that memory use does not grow with the size of a segment
+normalizer()
+{
+	echo "... with 200000 assertions in one segment and a 16 MB budget"
+	input=$(mktemp)
+	{ echo "(set-logic QF_LIA) (declare-fun y () Int) (declare-fun x () Int)"
+	  seq 200000 | sed 's/.*/(assert (> x &))/'
+	  echo "(assert (> y 0)) (check-sat)"; } > ${input}
+	${SCRAMBLER} -seed 0 -max-memory 16 < ${input} > ${input}.out 2>/dev/null
+	status=$?
+	if [ $status -ne 0 ] ||
+	   ! cmp -s ${input}.out <({ echo "(set-option :print-success false)"
+	                             echo "(set-logic QF_LIA)"
+	                             echo "(declare-fun y () Int)"
+	                             echo "(declare-fun x () Int)"
+	                             seq 200000 | sed 's/.*/(assert (> x &))/'
+	                             echo "(assert (> y 0))"
+	                             echo "(check-sat)"; })
+	then
+		echo -e "${RED}error:${NOCOLOR} Normalized output (exit code $status) differs from the input"
+		exitcode=1
+	fi
+	rm -f ${input} ${input}.out
+}
+
+# commands at the start of a segment that do not depend on the rest of
+# it (e.g., set-logic) must be printed before the segment's check-sat
+# has been read, which the input is held back for (through a FIFO); the
+# time to first byte is printed with -stats (-seed 0 is not streamed
+# this way: it writes each command as it is parsed, but flushes the
+# output once per segment)
+streaming()
+{
+  echo "... with seed $1"
+	dir=$(mktemp -d)
+	mkfifo ${dir}/in
+	${SCRAMBLER} -seed $1 -stats true < ${dir}/in > ${dir}/out 2> ${dir}/err &
+	pid=$!
+	( trap '' PIPE
+	  exec 3> ${dir}/in
+	  printf '(set-logic QF_UF)\n(declare-fun p () Bool)\n' >&3
+	  for i in $(seq 100); do
+	    grep -q "set-logic" ${dir}/out && break
+	    sleep 0.1
+	  done
+	  cp ${dir}/out ${dir}/early
+	  printf '(assert p)\n(check-sat)\n' >&3 )
+	wait ${pid}
+	status=$?
+	if [ $status -ne 0 ] || ! grep -q "^(set-logic QF_UF)$" ${dir}/early ||
+	   grep -q "check-sat" ${dir}/early
+	then
+		echo -e "${RED}error:${NOCOLOR} set-logic was not printed before check-sat was read (exit code $status)"
+		exitcode=1
+	fi
+	if ! grep -q "^\[stats\] time to first byte: " ${dir}/err
+	then
+		echo -e "${RED}error:${NOCOLOR} -stats did not report the time to first byte"
+		exitcode=1
+	fi
+	rm -rf ${dir}
+}
+
+# -unroll-incremental writes one file per check-sat (compared in index
+# order), which must be what the scrambler prints for that query on its
+# own (the query as written with -seed 0, without its set-option line);
+# popped commands that no pending query contains are deleted right away,
+# so that many push/pop rounds before a check-sat fit into a small budget
+unroll()
+{
+  echo "... with seed $2"
+	dir=$(mktemp -d)
+	for test in $1/*.smt2; do
+		echo ${test}
+		tname=`basename $test`
+		tname=${tname%.*}
+		rm -f "${dir:?}"/*
+		${SCRAMBLER} -seed $2 -unroll-incremental ${dir}/q < ${test} > /dev/null 2>&1
+		result=$(diff <(n=1; while [ -f ${dir}/q-$n.smt2 ]; do
+		                  echo "; query $n"; cat ${dir}/q-$n.smt2; n=$((n+1)); done) \
+		              $1/expect/${tname}.$2.unroll.expect)
+		if [ ! -z "$result" ]
+    then
+			echo -e "${RED}error:${NOCOLOR} Difference between expected and actual result:"
+			echo $result
+			exitcode=1
+		fi
+		${SCRAMBLER} -seed 0 -unroll-incremental ${dir}/raw < ${test} > /dev/null 2>&1
+		for query in ${dir}/q-*.smt2; do
+			raw=${dir}/raw-${query##*/q-}
+			if ! cmp -s ${query} <(tail -n +2 ${raw} | ${SCRAMBLER} -seed $2 2>/dev/null)
+			then
+				echo -e "${RED}error:${NOCOLOR} ${query##*/} differs from the scrambled query"
+				exitcode=1
+			fi
+		done
+	done
+	echo "... with 20000 push/assert/pop rounds and a 64 MB budget"
+	input=$(mktemp)
+	{ echo "(set-logic QF_LIA) (declare-fun x () Int) (check-sat)"
+	  for i in $(seq 20000); do
+	    printf '(push 1) (assert (> (+'; printf ' x%.0s' $(seq 200)
+	    echo ') 0)) (pop 1)'
+	  done
+	  echo "(check-sat)"; } > ${input}
+	rm -f "${dir:?}"/*
+	${SCRAMBLER} -seed $2 -max-memory 64 -unroll-incremental ${dir}/q < ${input} > /dev/null 2>&1
+	status=$?
+	if [ $status -ne 0 ] || [ ! -f ${dir}/q-2.smt2 ]
+	then
+		echo -e "${RED}error:${NOCOLOR} Unrolling push/pop rounds failed (exit code $status)"
+		exitcode=1
+	fi
+	echo "... with options that do not apply to unrolled queries"
+	for option in "-format binary" "-out ${dir}/out.smt2" "-chunk-size 4096"; do
+		${SCRAMBLER} -seed $2 ${option} -unroll-incremental ${dir}/q < ${input} > /dev/null 2>&1
+		status=$?
+		if [ $status -ne 1 ] || [ -e ${dir}/out.smt2 ]
+		then
+			echo -e "${RED}error:${NOCOLOR} ${option} with -unroll-incremental was not rejected (exit code $status)"
+			exitcode=1
+		fi
+	done
+	rm -rf ${input} ${dir}
+}
+
+# the binary output format (-format binary), decoded back to text, must
+# be identical to the text output
+roundtrip()
+{
+  echo "... with seed $2"
+	for test in $1/*.smt2; do
+		echo ${test}
+		result=$(diff <(${SCRAMBLER} -seed $2 $3 < ${test} 2>/dev/null) \
+		              <(${SCRAMBLER} -seed $2 $3 -format binary < ${test} 2>/dev/null | ${DECODER}))
+		if [ ! -z "$result" ]
+    then
+			echo -e "${RED}error:${NOCOLOR} Difference between text and decoded binary output:"
+			echo $result
+			exitcode=1
+		fi
+	done
+}
+
+chunked()
+{
+  echo "... with seed $2 and chunk size $3"
+	for test in $1/*.smt2; do
+		echo ${test}
+		result=$(diff <(${SCRAMBLER} -seed $2 < ${test} 2>/dev/null) \
+		              <(${SCRAMBLER} -seed $2 -chunk-size $3 < ${test} 2>/dev/null))
+		if [ ! -z "$result" ]
+    then
+			echo -e "${RED}error:${NOCOLOR} Difference between direct and pulled output:"
+			echo $result
+			exitcode=1
+		fi
+	done
+	echo "... with a term nested 100000 levels deep (and -engine auto)"
+	deep=$(mktemp)
+	deep_input 100000 > ${deep}
+	${SCRAMBLER} -seed $2 -engine auto -chunk-size $3 < ${deep} > ${deep}.out 2>/dev/null
+	status=$?
+	if [ $status -ne 0 ] ||
+	   ! cmp -s <(${SCRAMBLER} -seed $2 -engine auto < ${deep} 2>/dev/null) ${deep}.out
+	then
+		echo -e "${RED}error:${NOCOLOR} Pulled output (exit code $status) differs from direct output"
+		exitcode=1
+	fi
+	rm -f ${deep} ${deep}.out
+}
+
+# generous budgets (-max-memory, -max-time) must not change the output,
+# and a budget that is exceeded must end the run with its exit code and
+# a JSON reason
+budgets()
+{
+  echo "... with seed $2"
+	for test in $1/*.smt2; do
+		echo ${test}
+		result=$(diff <(${SCRAMBLER} -seed $2 < ${test} 2>/dev/null) \
+		              <(${SCRAMBLER} -seed $2 -max-memory 4096 -max-time 3600 < ${test} 2>/dev/null))
+		if [ ! -z "$result" ]
+    then
+			echo -e "${RED}error:${NOCOLOR} Difference between output with and without budgets:"
+			echo $result
+			exitcode=1
+		fi
+	done
+	echo "... exceeding the memory budget"
+	reason=$({ echo "(set-logic QF_LIA) (declare-fun x () Int)"
+	           seq 200000 | sed 's/.*/(assert (> x &))/'
+	           echo "(check-sat)"; } |
+	         ${SCRAMBLER} -seed $2 -max-memory 1 2>&1 >/dev/null)
+	status=$?
+	if [ $status -ne 3 ] || [[ "$reason" != '{"reason":"max-memory",'* ]]
+	then
+		echo -e "${RED}error:${NOCOLOR} Expected exit code 3 and a JSON reason, got $status: $reason"
+		exitcode=1
+	fi
+	echo "... with a term nested 400000 levels deep (on one thread)"
+	deep=$(mktemp)
+	deep_input 400000 > ${deep}
+	${SCRAMBLER} -seed $2 -max-memory 4000 -max-time 60 < ${deep} > ${deep}.out 2>/dev/null
+	status=$?
+	if [ $status -ne 0 ] ||
+	   ! cmp -s <(${SCRAMBLER} -seed $2 -threads 4 < ${deep} 2>/dev/null) ${deep}.out
+	then
+		echo -e "${RED}error:${NOCOLOR} Output with budgets (exit code $status) differs from 4 threads"
+		exitcode=1
+	fi
+	echo "... with a term nested 400000 levels deep, whose stack exceeds the budget"
+	${SCRAMBLER} -seed $2 -max-memory 50 < ${deep} > /dev/null 2> ${deep}.out
+	status=$?
+	reason=$(tail -n 1 ${deep}.out)
+	if [ $status -ne 3 ] || [[ "$reason" != '{"reason":"max-memory",'* ]]
+	then
+		echo -e "${RED}error:${NOCOLOR} Expected exit code 3 and a JSON reason, got $status: $reason"
+		exitcode=1
+	fi
+	rm -f ${deep} ${deep}.out
+}
+
+# progress lines (-progress) must not change the output, and the last
+# line must report the end of the run
+progress()
+{
+  echo "... with seed $2"
+	for test in $1/*.smt2; do
+		echo ${test}
+		result=$(diff <(${SCRAMBLER} -seed $2 < ${test} 2>/dev/null) \
+		              <(${SCRAMBLER} -seed $2 -progress 3 < ${test} 2>/dev/null 3>/dev/null))
+		last=$(${SCRAMBLER} -seed $2 -progress 3 < ${test} 3>&1 >/dev/null 2>/dev/null | tail -n 1)
+		if [ ! -z "$result" ] || [[ "$last" != *'"done":true}' ]]
+    then
+			echo -e "${RED}error:${NOCOLOR} Output changed by -progress, or no last progress line:"
+			echo $result $last
+			exitcode=1
+		fi
+	done
+}
+
+SCRAMBLER="${SCRIPT_DIR}/../scrambler"
+DECODER="${SCRIPT_DIR}/../tools/decode_binary"
+INTERN_BENCH="${SCRIPT_DIR}/../bench/intern_bench"
+
+[ -x "${DECODER}" ] || die "'${DECODER}' does not exist (run 'make tools/decode_binary')"
+[ -x "${INTERN_BENCH}" ] || die "'${INTERN_BENCH}' does not exist (run 'make bench/intern_bench')"
+
 [ -d "${TESTS_SMT_COMP_DIR}" ] || die "directory '${TESTS_SMT_COMP_DIR}' does not exist"
 [ -d "${TESTS_SMT_COMP_DIR}/expect" ] || die "directory '${TESTS_SMT_COMP_DIR}/expect' does not exist"
 
@@ -75,6 +531,62 @@ echo -e "\nRun Z3 scrambler..."
 runtest ${TESTS_Z3_DIR} ${SCRIPT_DIR}/../process.z3 0 z3
 runtest ${TESTS_Z3_DIR} ${SCRIPT_DIR}/../process.z3 1234 z3
 
+echo -e "\nRun with 4 threads..."
+threads "${TESTS_SMT_COMP_DIR}" 0
+threads "${TESTS_SMT_COMP_DIR}" 1234
+
+echo -e "\nRun normalizer (-seed 0)..."
+normalizer
+
+echo -e "\nRun with repeated push and pop..."
+pushpop 0
+pushpop 1234
+
+echo -e "\nRun with -out FILE..."
+outfile "${TESTS_SMT_COMP_DIR}" 0
+outfile "${TESTS_SMT_COMP_DIR}" 1234
+
+echo -e "\nRun with commands streamed before the end of a segment..."
+streaming 1234
+streaming 42
+
+echo -e "\nRun with -unroll-incremental..."
+unroll "${TESTS_SMT_COMP_DIR}" 0
+unroll "${TESTS_SMT_COMP_DIR}" 1234
+
+echo -e "\nRun with -emit-index..."
+emit_index "${TESTS_SMT_COMP_DIR}" 0
+emit_index "${TESTS_SMT_COMP_DIR}" 1234
+
+echo -e "\nRun with statistics..."
+stats "${TESTS_SMT_COMP_DIR}" 1234
+
+echo -e "\nRun with -engine auto..."
+engine "${TESTS_SMT_COMP_DIR}" 1234
+
+echo -e "\nRun binary output round trip..."
+roundtrip "${TESTS_SMT_COMP_DIR}" 0
+roundtrip "${TESTS_SMT_COMP_DIR}" 1234
+roundtrip "${TESTS_SMT_COMP_DIR}" 1234 "-gen-unsat-core true -gen-model-val true"
+roundtrip "${TESTS_Z3_DIR}" 1234 "-support-z3 true -support-non-smtcomp true"
+
+echo -e "\nRun output pulled in chunks..."
+chunked "${TESTS_SMT_COMP_DIR}" 1234 1
+chunked "${TESTS_SMT_COMP_DIR}" 1234 4096
+
+echo -e "\nRun with resource budgets..."
+budgets "${TESTS_SMT_COMP_DIR}" 1234
+
+echo -e "\nRun with progress lines..."
+progress "${TESTS_SMT_COMP_DIR}" 1234
+
+echo -e "\nRun concurrent intern table (growing while threads insert)..."
+if ! "${INTERN_BENCH}" 16384 > /dev/null
+then
+	echo -e "${RED}error:${NOCOLOR} Wrong name ids from the concurrent intern table"
+	exitcode=1
+fi
+
 echo -e "\nRun assertion counter..."
 runtest "${TESTS_ASRT_COUNT_DIR}" "${SCRIPT_DIR}"/../process.assertion-count 0 asrt-count
 
@@ -0,0 +1,78 @@
+/* -*- C++ -*-
+ *
+ * Reference decoder for the binary term output format (binary.h)
+ *
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Converts a benchmark that the scrambler wrote with -format binary
+ * back to text, which is identical to the scrambler's text output.
+ * FILE is mapped into memory (and decoded in place); without FILE, the
+ * benchmark is read from stdin.
+ *
+ * Usage: decode_binary [FILE]
+ */
+
+#include "../binary.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <iostream>
+#include <iterator>
+#include <string>
+
+int main(int argc, char **argv)
+{
+    const char *data;
+    size_t len;
+    std::string input;
+    if (argc > 1) {
+        int fd = open(argv[1], O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0) {
+            perror(argv[1]);
+            return 1;
+        }
+        len = st.st_size;
+        void *p = len ? mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+        if (p == MAP_FAILED) {
+            perror(argv[1]);
+            return 1;
+        }
+        data = (const char *)p;
+    } else {
+        input.assign(std::istreambuf_iterator<char>(std::cin),
+                     std::istreambuf_iterator<char>());
+        data = input.data();
+        len = input.size();
+    }
+
+    std::ios::sync_with_stdio(false);
+    std::string error;
+    if (!scrambler::decode_binary(data, len, std::cout, error)) {
+        std::cout.flush();
+        std::cerr << "ERROR " << error << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,850 @@
+/* -*- C++ -*-
+ *
+ * Performance fuzzing: a search for slow and memory-hungry inputs
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Mutates SMT-LIB benchmarks into shapes that have been expensive in
+ * practice (deep nesting, large push/pop counts, many :named and
+ * :pattern annotations, huge quoted symbols, long let chains, repeated
+ * commands and segments), runs the scrambler on each mutant, and keeps
+ * the mutants that cost the most per input byte: CPU time, and peak
+ * resident memory, each above the cost of scrambling (check-sat) alone.
+ * Like PerfFuzz, the search is driven by cost rather than by crashes:
+ * the costliest inputs found so far are the ones mutated further.
+ *
+ * Every mutant runs in its own scrambler process (the parser keeps
+ * global state), with -max-time and -max-memory (see governor.h), so
+ * that runaway inputs end with a known exit code and count as costing
+ * the whole budget. Inputs on which the scrambler crashes are saved as
+ * crash-N.smt2.
+ *
+ * The KEEP slowest and KEEP hungriest inputs are saved to OUT_DIR as
+ * slow-N.smt2 and hungry-N.smt2, each with its measured cost in a
+ * .cost file (one line of JSON), which makes OUT_DIR a set of
+ * regression fixtures: with -check, the inputs in OUT_DIR are measured
+ * again, and compared to their recorded costs (the exit code is 1 if
+ * any costs more than TOLERANCE times as much, in time for slow inputs
+ * and in memory for hungry ones, or crashes). Costs depend on the
+ * machine, so fixtures are best checked where they were recorded.
+ *
+ * Usage: perf_fuzz [OPTIONS] SEED_FILE...
+ *        perf_fuzz -check OUT_DIR [-scrambler PATH] [-tolerance X]
+ *
+ *    -scrambler PATH   the scrambler to run (default: ./scrambler)
+ *    -out OUT_DIR      where the worst inputs are saved (default: .)
+ *    -runs N           number of mutants to run (default: 1000)
+ *    -seed N           seed of the mutations (default: 1)
+ *    -keep KEEP        inputs kept per cost (default: 5)
+ *    -max-bytes N      largest mutant (default: 1048576)
+ *    -max-time SECS    -max-time of each run (default: 10)
+ *    -max-memory MB    -max-memory of each run (default: 2048)
+ *    -tolerance X      cost ratio that -check accepts (default: 2)
+ */
+
+#include "../shuffle.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+// the exit codes of -max-memory and -max-time (see governor.h)
+const int exit_max_memory = 3;
+const int exit_max_time = 4;
+
+// costs are per input byte, but inputs below this size are charged as
+// if they had this size (their costs are mostly measurement noise)
+const size_t min_charged_bytes = 4096;
+
+// -check accepts any cost up to TOLERANCE times these floors, which
+// stand for noise (10 ms, or 1 MB, on an input of min_charged_bytes):
+// a recorded cost of 0 would otherwise make any noise a regression
+const double min_ns_per_byte = 1e7 / min_charged_bytes;
+const double min_rss_per_byte = 1048576.0 / min_charged_bytes;
+
+struct options {
+    std::string scrambler;
+    std::string out_dir;
+    long runs;
+    uint64_t seed;
+    size_t keep;
+    size_t max_bytes;
+    long max_time;
+    long max_memory;
+    double tolerance;
+};
+
+struct cost {
+    double seconds;     // CPU time (user and system)
+    uint64_t max_rss;   // peak resident memory, in bytes
+    int exit_code;      // -1 if the scrambler was killed by a signal
+    int signal;
+};
+
+// an input, with its cost above the baseline
+struct input {
+    std::string text;
+    std::string shape;  // the mutations that produced it
+    cost c;
+    double ns_per_byte;
+    double rss_per_byte;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+/*
+ * running the scrambler
+ */
+
+bool write_file(const std::string &path, const std::string &text)
+{
+    std::ofstream out(path.c_str(), std::ios::binary | std::ios::trunc);
+    out.write(text.data(), text.size());
+    out.close();
+    return !out.fail();
+}
+
+bool read_file(const std::string &path, std::string &text)
+{
+    std::ifstream in(path.c_str(), std::ios::binary);
+    if (!in) {
+        return false;
+    }
+    std::ostringstream s;
+    s << in.rdbuf();
+    text = s.str();
+    return true;
+}
+
+// runs the scrambler on the file at path (see launch below)
+cost spawn(const options &o, const std::string &path)
+{
+    std::string max_time = std::to_string(o.max_time);
+    std::string max_memory = std::to_string(o.max_memory);
+    const char *argv[] = {
+        o.scrambler.c_str(), "-seed", "1", "-max-time", max_time.c_str(),
+        "-max-memory", max_memory.c_str(), NULL
+    };
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        exit(1);
+    }
+    if (pid == 0) {
+        int in = open(path.c_str(), O_RDONLY);
+        int out = open("/dev/null", O_WRONLY);
+        if (in < 0 || out < 0) {
+            _exit(127);
+        }
+        dup2(in, STDIN_FILENO);
+        dup2(out, STDOUT_FILENO);
+        dup2(out, STDERR_FILENO);
+        close(in);
+        close(out);
+        execv(argv[0], (char **)argv);
+        _exit(127);
+    }
+    int status;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) != pid) {
+        perror("wait4");
+        exit(1);
+    }
+    cost c;
+    c.seconds = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec * 1e-6 +
+                usage.ru_stime.tv_sec + usage.ru_stime.tv_usec * 1e-6;
+    c.max_rss = (uint64_t)usage.ru_maxrss * 1024;
+    c.exit_code = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+    c.signal = WIFSIGNALED(status) ? WTERMSIG(status) : 0;
+    if (c.exit_code == exit_max_time) {
+        c.seconds = std::max(c.seconds, (double)o.max_time);
+    } else if (c.exit_code == exit_max_memory) {
+        c.max_rss = std::max(c.max_rss, (uint64_t)o.max_memory << 20);
+    }
+    return c;
+}
+
+/*
+ * The peak resident memory of a process that was forked includes the
+ * memory that it shared with its parent before it called exec. Hence
+ * the scrambler is started by a launcher process, which is forked
+ * before the fuzzer grows: it reads the paths of inputs from a pipe,
+ * runs the scrambler on each, and writes back the costs.
+ */
+int to_launcher = -1;
+int from_launcher = -1;
+
+bool read_all(int fd, void *data, size_t len)
+{
+    char *p = (char *)data;
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+bool write_all(int fd, const void *data, size_t len)
+{
+    const char *p = (const char *)data;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+void start_launcher(const options &o)
+{
+    int requests[2];
+    int replies[2];
+    if (pipe(requests) != 0 || pipe(replies) != 0) {
+        perror("pipe");
+        exit(1);
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        exit(1);
+    }
+    if (pid == 0) {
+        close(requests[1]);
+        close(replies[0]);
+        uint32_t len;
+        // ends when the fuzzer closes the pipe
+        while (read_all(requests[0], &len, sizeof(len))) {
+            std::string path(len, '\0');
+            if (!read_all(requests[0], &path[0], len)) {
+                break;
+            }
+            cost c = spawn(o, path);
+            if (!write_all(replies[1], &c, sizeof(c))) {
+                break;
+            }
+        }
+        _exit(0);
+    }
+    close(requests[0]);
+    close(replies[1]);
+    to_launcher = requests[1];
+    from_launcher = replies[0];
+}
+
+cost run(const options &o, const std::string &path)
+{
+    uint32_t len = path.size();
+    cost c;
+    if (!write_all(to_launcher, &len, sizeof(len)) ||
+        !write_all(to_launcher, path.data(), len) ||
+        !read_all(from_launcher, &c, sizeof(c))) {
+        std::cerr << "ERROR the launcher process failed" << std::endl;
+        exit(1);
+    }
+    return c;
+}
+
+// the cheapest of several runs, which filters out noise
+cost measure(const options &o, const std::string &path, int times)
+{
+    cost best = run(o, path);
+    for (int i = 1; i < times; ++i) {
+        cost c = run(o, path);
+        best.seconds = std::min(best.seconds, c.seconds);
+        best.max_rss = std::min(best.max_rss, c.max_rss);
+    }
+    return best;
+}
+
+void charge(input &x, const cost &baseline)
+{
+    double bytes = std::max(x.text.size(), min_charged_bytes);
+    x.ns_per_byte = std::max(x.c.seconds - baseline.seconds, 0.0) * 1e9 / bytes;
+    x.rss_per_byte = x.c.max_rss > baseline.max_rss ?
+        (x.c.max_rss - baseline.max_rss) / bytes : 0;
+}
+
+std::string cost_line(const input &x)
+{
+    std::ostringstream s;
+    s << "{\"bytes\":" << x.text.size() << ",\"ns_per_byte\":"
+      << x.ns_per_byte << ",\"rss_per_byte\":" << x.rss_per_byte
+      << ",\"seconds\":" << x.c.seconds << ",\"max_rss\":" << x.c.max_rss
+      << ",\"exit\":" << x.c.exit_code << ",\"shape\":\"" << x.shape
+      << "\"}\n";
+    return s.str();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+/*
+ * mutations
+ */
+
+// Splits text into its top-level commands (and drops what is between
+// them). Strings, quoted symbols and comments are skipped over.
+std::vector<std::string> split_commands(const std::string &text)
+{
+    std::vector<std::string> commands;
+    size_t depth = 0;
+    size_t start = 0;
+    for (size_t i = 0; i < text.size(); ++i) {
+        char c = text[i];
+        if (c == '"' || c == '|') {
+            size_t end = text.find(c, i + 1);
+            i = end == std::string::npos ? text.size() : end;
+        } else if (c == ';') {
+            size_t end = text.find('\n', i);
+            i = end == std::string::npos ? text.size() : end;
+        } else if (c == '(') {
+            if (depth++ == 0) {
+                start = i;
+            }
+        } else if (c == ')' && depth > 0 && --depth == 0) {
+            commands.push_back(text.substr(start, i + 1 - start));
+        }
+    }
+    return commands;
+}
+
+bool starts_with(const std::string &s, const char *prefix)
+{
+    return s.compare(0, strlen(prefix), prefix) == 0;
+}
+
+// the term of an assertion "(assert TERM)"
+bool split_assert(const std::string &cmd, std::string &term)
+{
+    if (!starts_with(cmd, "(assert ")) {
+        return false;
+    }
+    term = cmd.substr(8, cmd.size() - 9);
+    return true;
+}
+
+// the index of a random assertion (or the number of commands if none)
+size_t random_assert(std::vector<std::string> &commands,
+                     scrambler::shuffle_rng &rng)
+{
+    std::vector<size_t> asserts;
+    for (size_t i = 0; i < commands.size(); ++i) {
+        if (starts_with(commands[i], "(assert ")) {
+            asserts.push_back(i);
+        }
+    }
+    return asserts.empty() ? commands.size() :
+        asserts[rng.below(asserts.size())];
+}
+
+// a random position after set-logic (if any)
+size_t random_position(const std::vector<std::string> &commands,
+                       scrambler::shuffle_rng &rng)
+{
+    size_t first = 0;
+    for (size_t i = 0; i < commands.size(); ++i) {
+        if (starts_with(commands[i], "(set-logic")) {
+            first = i + 1;
+        }
+    }
+    return first + rng.below(commands.size() - first + 1);
+}
+
+// 1, 2, 4, ..., up to 2^max_log (each about equally likely)
+uint64_t random_size(scrambler::shuffle_rng &rng, unsigned max_log)
+{
+    return 1ULL << rng.below(max_log + 1);
+}
+
+std::string repeat(const std::string &s, uint64_t n)
+{
+    std::string result;
+    result.reserve(s.size() * n);
+    for (uint64_t i = 0; i < n; ++i) {
+        result += s;
+    }
+    return result;
+}
+
+// at most n, but small enough that n copies of len bytes fit into
+// max_bytes
+uint64_t copies(uint64_t n, size_t len, size_t max_bytes)
+{
+    return std::max<uint64_t>(std::min<uint64_t>(n, max_bytes / (len + 1)), 1);
+}
+
+// Applies a random mutation to commands, and returns its name (or NULL
+// if it does not apply). Repetitions are limited by max_bytes.
+const char *mutate(std::vector<std::string> &commands,
+                   const std::vector<input> &corpus,
+                   scrambler::shuffle_rng &rng, uint64_t &next_name,
+                   size_t max_bytes)
+{
+    std::string term;
+    switch (rng.below(8)) {
+    case 0: {
+        // nesting
+        size_t i = random_assert(commands, rng);
+        if (i == commands.size() || !split_assert(commands[i], term)) {
+            return NULL;
+        }
+        uint64_t depth = random_size(rng, 14);
+        commands[i] = "(assert " + repeat("(not ", 2 * depth) + term +
+                      std::string(2 * depth, ')') + ")";
+        return "nest";
+    }
+    case 1: {
+        // push N ... pop N
+        uint64_t n = random_size(rng, 20);
+        size_t i = random_position(commands, rng);
+        size_t j = i + rng.below(commands.size() - i + 1);
+        std::string count = std::to_string(n);
+        commands.insert(commands.begin() + j, "(pop " + count + ")");
+        commands.insert(commands.begin() + i, "(push " + count + ")");
+        return "push";
+    }
+    case 2: {
+        // :named annotations on many assertions
+        uint64_t n = random_size(rng, 12);
+        for (uint64_t k = 0; k < n; ++k) {
+            size_t i = random_assert(commands, rng);
+            if (i == commands.size() || !split_assert(commands[i], term)) {
+                return NULL;
+            }
+            commands[i] = "(assert (! " + term + " :named fuzz" +
+                          std::to_string(next_name++) + "))";
+        }
+        return "named";
+    }
+    case 3: {
+        // :pattern annotations
+        size_t i = random_assert(commands, rng);
+        if (i == commands.size() || !split_assert(commands[i], term)) {
+            return NULL;
+        }
+        uint64_t n = copies(random_size(rng, 10), term.size() + 12, max_bytes);
+        commands[i] = "(assert (! " + term + repeat(" :pattern (" + term + ")", n) +
+                      "))";
+        return "pattern";
+    }
+    case 4: {
+        // a huge quoted symbol
+        uint64_t len = random_size(rng, 20);
+        std::string name = "|";
+        for (uint64_t k = 0; k < len; ++k) {
+            name.push_back(" abcxyz0189(){}#:;.\n"[rng.below(20)]);
+        }
+        name += "|";
+        size_t i = random_position(commands, rng);
+        commands.insert(commands.begin() + i, "(assert " + name + ")");
+        commands.insert(commands.begin() + i,
+                        "(declare-fun " + name + " () Bool)");
+        return "quoted";
+    }
+    case 5: {
+        // a long let chain
+        uint64_t n = random_size(rng, 14);
+        std::string chain;
+        for (uint64_t k = 0; k < n; ++k) {
+            chain += "(let ((fuzz" + std::to_string(next_name + k) + " " +
+                     (k ? "fuzz" + std::to_string(next_name + k - 1) :
+                      std::string("true")) + ")) ";
+        }
+        chain += "fuzz" + std::to_string(next_name + n - 1) +
+                 std::string(n, ')');
+        next_name += n;
+        size_t i = random_position(commands, rng);
+        commands.insert(commands.begin() + i, "(assert " + chain + ")");
+        return "let";
+    }
+    case 6: {
+        // a repeated command (or segment, for check-sat)
+        if (commands.empty()) {
+            return NULL;
+        }
+        size_t i = rng.below(commands.size());
+        if (starts_with(commands[i], "(set-logic") ||
+            starts_with(commands[i], "(declare") ||
+            starts_with(commands[i], "(define")) {
+            return NULL;
+        }
+        uint64_t n = copies(random_size(rng, 12), commands[i].size(),
+                            max_bytes);
+        std::string cmd = commands[i];
+        commands.insert(commands.begin() + i, n, cmd);
+        return "repeat";
+    }
+    default: {
+        // assertions spliced in from another input
+        const input &other = corpus[rng.below(corpus.size())];
+        std::vector<std::string> theirs = split_commands(other.text);
+        size_t i = random_position(commands, rng);
+        size_t n = 0;
+        for (size_t k = 0; k < theirs.size(); ++k) {
+            if (starts_with(theirs[k], "(assert ")) {
+                commands.insert(commands.begin() + i + n++, theirs[k]);
+            }
+        }
+        return n ? "splice" : NULL;
+    }
+    }
+}
+
+std::string join(const std::vector<std::string> &commands)
+{
+    std::string text;
+    for (size_t i = 0; i < commands.size(); ++i) {
+        text += commands[i];
+        text += '\n';
+    }
+    return text;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+/*
+ * the worst inputs
+ */
+
+struct by_time {
+    bool operator()(const input &a, const input &b) const {
+        return a.ns_per_byte > b.ns_per_byte;
+    }
+};
+
+struct by_memory {
+    bool operator()(const input &a, const input &b) const {
+        return a.rss_per_byte > b.rss_per_byte;
+    }
+};
+
+// Adds x to worst (sorted by less, at most keep inputs); returns true
+// if x is kept.
+template <typename Less>
+bool offer(std::vector<input> &worst, const input &x, size_t keep, Less less)
+{
+    if (worst.size() == keep && !less(x, worst.back())) {
+        return false;
+    }
+    for (size_t i = 0; i < worst.size(); ++i) {
+        if (worst[i].text == x.text) {
+            return false;
+        }
+    }
+    worst.insert(std::upper_bound(worst.begin(), worst.end(), x, less), x);
+    if (worst.size() > keep) {
+        worst.pop_back();
+    }
+    return true;
+}
+
+void save(const options &o, const char *prefix,
+          const std::vector<input> &worst)
+{
+    for (size_t i = 0; i < worst.size(); ++i) {
+        std::string base = o.out_dir + "/" + prefix + "-" +
+                           std::to_string(i + 1);
+        if (!write_file(base + ".smt2", worst[i].text) ||
+            !write_file(base + ".cost", cost_line(worst[i]))) {
+            std::cerr << "ERROR writing " << base << ".smt2" << std::endl;
+            exit(1);
+        }
+    }
+}
+
+int fuzz(const options &o, const std::vector<std::string> &seed_files)
+{
+    std::string scratch = o.out_dir + "/.mutant.smt2";
+    if (!write_file(scratch, "(check-sat)\n")) {
+        std::cerr << "ERROR writing " << scratch << std::endl;
+        return 1;
+    }
+    cost baseline = measure(o, scratch, 5);
+
+    std::vector<input> corpus;
+    for (size_t i = 0; i < seed_files.size(); ++i) {
+        input x;
+        if (!read_file(seed_files[i], x.text)) {
+            std::cerr << "ERROR reading " << seed_files[i] << std::endl;
+            return 1;
+        }
+        x.shape = "seed";
+        if (!write_file(scratch, x.text)) {
+            return 1;
+        }
+        x.c = run(o, scratch);
+        if (x.c.exit_code != 0) {
+            std::cerr << "skipping " << seed_files[i]
+                      << " (the scrambler fails on it)" << std::endl;
+            continue;
+        }
+        charge(x, baseline);
+        corpus.push_back(x);
+    }
+    if (corpus.empty()) {
+        std::cerr << "ERROR no seed file that the scrambler accepts" << std::endl;
+        return 1;
+    }
+
+    std::vector<input> slow;
+    std::vector<input> hungry;
+    scrambler::shuffle_rng rng(o.seed);
+    uint64_t next_name = 0;
+    size_t crashes = 0;
+    for (long run_index = 0; run_index < o.runs; ++run_index) {
+        // the parent is a seed, a slow input or a hungry one (about
+        // equally often), so that costly shapes are mutated further
+        const std::vector<input> *pool = &corpus;
+        uint64_t choice = rng.below(3);
+        if (choice == 1 && !slow.empty()) {
+            pool = &slow;
+        } else if (choice == 2 && !hungry.empty()) {
+            pool = &hungry;
+        }
+        const input &parent = (*pool)[rng.below(pool->size())];
+        std::vector<std::string> commands = split_commands(parent.text);
+        input x;
+        x.shape = parent.shape == "seed" ? "" : parent.shape;
+        bool mutated = false;
+        for (uint64_t k = 1 + rng.below(3); k > 0; --k) {
+            const char *name = mutate(commands, corpus, rng, next_name,
+                                      o.max_bytes);
+            if (name) {
+                x.shape += (x.shape.empty() ? "" : "+") + std::string(name);
+                mutated = true;
+            }
+            x.text = join(commands);
+            if (x.text.size() > o.max_bytes) {
+                break;
+            }
+        }
+        if (!mutated || x.text.size() > o.max_bytes) {
+            continue;
+        }
+        if (!write_file(scratch, x.text)) {
+            return 1;
+        }
+        x.c = run(o, scratch);
+        if (x.c.signal) {
+            std::string path = o.out_dir + "/crash-" +
+                               std::to_string(++crashes) + ".smt2";
+            write_file(path, x.text);
+            std::cout << "run " << run_index << ": signal " << x.c.signal
+                      << " (" << x.shape << "), saved as " << path << std::endl;
+            continue;
+        }
+        if (x.c.exit_code != 0 && x.c.exit_code != exit_max_memory &&
+            x.c.exit_code != exit_max_time) {
+            // not a benchmark that the scrambler accepts
+            continue;
+        }
+        charge(x, baseline);
+        bool is_slow = slow.size() < o.keep || by_time()(x, slow.back());
+        bool is_hungry = hungry.size() < o.keep || by_memory()(x, hungry.back());
+        if (!is_slow && !is_hungry) {
+            continue;
+        }
+        // a second measurement confirms (or corrects) the first
+        x.c = measure(o, scratch, 3);
+        charge(x, baseline);
+        if (offer(slow, x, o.keep, by_time())) {
+            std::cout << "run " << run_index << ": slow " << x.ns_per_byte
+                      << " ns/byte, " << x.text.size() << " bytes ("
+                      << x.shape << ")" << std::endl;
+            save(o, "slow", slow);
+        }
+        if (offer(hungry, x, o.keep, by_memory())) {
+            std::cout << "run " << run_index << ": hungry " << x.rss_per_byte
+                      << " bytes/byte, " << x.text.size() << " bytes ("
+                      << x.shape << ")" << std::endl;
+            save(o, "hungry", hungry);
+        }
+    }
+    unlink(scratch.c_str());
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+/*
+ * -check
+ */
+
+double field(const std::string &json, const char *name)
+{
+    std::string key = std::string("\"") + name + "\":";
+    size_t pos = json.find(key);
+    return pos == std::string::npos ? 0 :
+        strtod(json.c_str() + pos + key.size(), NULL);
+}
+
+int check(const options &o)
+{
+    DIR *dir = opendir(o.out_dir.c_str());
+    if (!dir) {
+        perror(o.out_dir.c_str());
+        return 1;
+    }
+    std::vector<std::string> names;
+    while (struct dirent *e = readdir(dir)) {
+        std::string name = e->d_name;
+        if (name.size() > 5 && name.compare(name.size() - 5, 5, ".cost") == 0) {
+            names.push_back(name.substr(0, name.size() - 5));
+        }
+    }
+    closedir(dir);
+    std::sort(names.begin(), names.end());
+
+    std::string scratch = o.out_dir + "/.mutant.smt2";
+    write_file(scratch, "(check-sat)\n");
+    cost baseline = measure(o, scratch, 5);
+    unlink(scratch.c_str());
+
+    int result = 0;
+    printf("%-16s %12s %12s %12s %12s\n", "input", "ns/byte", "recorded",
+           "rss/byte", "recorded");
+    for (size_t i = 0; i < names.size(); ++i) {
+        std::string base = o.out_dir + "/" + names[i];
+        input x;
+        std::string recorded;
+        if (!read_file(base + ".smt2", x.text) ||
+            !read_file(base + ".cost", recorded)) {
+            std::cerr << "ERROR reading " << base << ".smt2" << std::endl;
+            return 1;
+        }
+        x.c = measure(o, base + ".smt2", 3);
+        charge(x, baseline);
+        double ns = field(recorded, "ns_per_byte");
+        double rss = field(recorded, "rss_per_byte");
+        // a fixture is checked for the cost it was kept for
+        bool slow = names[i].compare(0, 5, "slow-") == 0;
+        bool hungry = names[i].compare(0, 7, "hungry-") == 0;
+        bool regressed =
+            (slow && x.ns_per_byte > o.tolerance * std::max(ns, min_ns_per_byte)) ||
+            (hungry && x.rss_per_byte > o.tolerance * std::max(rss, min_rss_per_byte)) ||
+            x.c.signal;
+        printf("%-16s %12.1f %12.1f %12.1f %12.1f%s\n", names[i].c_str(),
+               x.ns_per_byte, ns, x.rss_per_byte, rss,
+               regressed ? "  REGRESSED" : "");
+        if (regressed) {
+            result = 1;
+        }
+    }
+    return result;
+}
+
+void usage()
+{
+    std::cerr << "Usage: perf_fuzz [OPTIONS] SEED_FILE...\n"
+              << "       perf_fuzz -check OUT_DIR [-scrambler PATH] [-tolerance X]\n"
+              << "(see tools/perf_fuzz.cpp)" << std::endl;
+    exit(1);
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    options o;
+    o.scrambler = "./scrambler";
+    o.out_dir = ".";
+    o.runs = 1000;
+    o.seed = 1;
+    o.keep = 5;
+    o.max_bytes = 1 << 20;
+    o.max_time = 10;
+    o.max_memory = 2048;
+    o.tolerance = 2;
+    bool checking = false;
+    std::vector<std::string> seed_files;
+
+    for (int i = 1; i < argc; ) {
+        if (argv[i][0] != '-') {
+            seed_files.push_back(argv[i]);
+            ++i;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            usage();
+        }
+        const char *value = argv[i + 1];
+        if (strcmp(argv[i], "-scrambler") == 0) {
+            o.scrambler = value;
+        } else if (strcmp(argv[i], "-out") == 0) {
+            o.out_dir = value;
+        } else if (strcmp(argv[i], "-check") == 0) {
+            o.out_dir = value;
+            checking = true;
+        } else if (strcmp(argv[i], "-runs") == 0) {
+            o.runs = strtol(value, NULL, 10);
+        } else if (strcmp(argv[i], "-seed") == 0) {
+            o.seed = strtoull(value, NULL, 10);
+        } else if (strcmp(argv[i], "-keep") == 0) {
+            o.keep = strtoul(value, NULL, 10);
+        } else if (strcmp(argv[i], "-max-bytes") == 0) {
+            o.max_bytes = strtoul(value, NULL, 10);
+        } else if (strcmp(argv[i], "-max-time") == 0) {
+            o.max_time = strtol(value, NULL, 10);
+        } else if (strcmp(argv[i], "-max-memory") == 0) {
+            o.max_memory = strtol(value, NULL, 10);
+        } else if (strcmp(argv[i], "-tolerance") == 0) {
+            o.tolerance = strtod(value, NULL);
+        } else {
+            usage();
+        }
+        i += 2;
+    }
+    if (o.keep == 0 || o.max_time <= 0 || o.max_memory <= 0) {
+        usage();
+    }
+
+    if (!checking && seed_files.empty()) {
+        usage();
+    }
+    start_launcher(o);
+    return checking ? check(o) : fuzz(o, seed_files);
+}